@@ -1,29 +1,270 @@
 #include "adxl.h"
 
+/* Thresholds are 62.5 mg per LSB, see uadxl.h for the timing units */
+static const struct reg_sequence adxl345_event_defaults[] = {
+	{ ADXL345_REG_THRESH_TAP, 0x30 }, /* 3 g */
+	{ ADXL345_REG_DUR, 0x10 }, /* 10 ms */
+	{ ADXL345_REG_LATENT, 0x50 }, /* 100 ms */
+	{ ADXL345_REG_WINDOW, 0xC8 }, /* 250 ms */
+	{ ADXL345_REG_THRESH_ACT, 0x08 }, /* 0.5 g */
+	{ ADXL345_REG_THRESH_INACT, 0x04 }, /* 0.25 g */
+	{ ADXL345_REG_TIME_INACT, 0x05 }, /* 5 s */
+	{ ADXL345_REG_ACT_INACT_CTL, ADXL345_ACT_INACT_CTL_AC_XYZ },
+	{ ADXL345_REG_THRESH_FF, 0x07 }, /* 0.44 g */
+	{ ADXL345_REG_TIME_FF, 0x1E }, /* 150 ms */
+	{ ADXL345_REG_TAP_AXES, ADXL345_TAP_AXES_XYZ },
+	/* Latched events never hold INT1, which serves the watermark */
+	{ ADXL345_REG_INT_MAP, ADXL345_INT_EVENTS },
+};
+
 static const struct regmap_config regmap_spi_config = {
 	.reg_bits = 8,
 	.val_bits = 8,
 	.read_flag_mask = (BIT(7) | BIT(6)), /* Enable multi-byte read */
+	.write_flag_mask = BIT(6), /* Multi-byte write, for the resume burst */
 };
 
+static inline void adxl345_decode(const u8 *xyz_val, s16 *x, s16 *y, s16 *z)
+{
+	*x = (int16_t)((xyz_val[1] << 8) | xyz_val[0]);
+	*y = (int16_t)((xyz_val[3] << 8) | xyz_val[2]);
+	*z = (int16_t)((xyz_val[5] << 8) | xyz_val[4]);
+}
+
 #ifdef ENABLE_INTERRUPT
 static irqreturn_t adxl345_irq_handler(int irq, void *p)
 {
 	struct adxl_device *adxl = p;
+
+	/* Drain on the worker, keeping the line masked until it is done */
+	kthread_queue_work(adxl->worker, &adxl->poll_work);
+	kthread_flush_work(&adxl->poll_work);
 	return IRQ_HANDLED;
 }
 #endif
 
+static enum hrtimer_restart adxl345_poll_timer(struct hrtimer *timer)
+{
+	struct adxl_device *adxl =
+		container_of(timer, struct adxl_device, poll_timer);
+
+	kthread_queue_work(adxl->worker, &adxl->poll_work);
+	return HRTIMER_NORESTART;
+}
+
+static void adxl345_poll_work(struct kthread_work *work)
+{
+	struct adxl_device *adxl =
+		container_of(work, struct adxl_device, poll_work);
+	u64 period = ADXL345_RATE_PERIOD_NS(adxl->sample_rate);
+	s64 start = ktime_get_ns();
+
+	if (!READ_ONCE(adxl->polling))
+		return;
+
+	adxl345_drain_fifo(adxl);
+	atomic64_add(ktime_get_ns() - start, &adxl->busy_ns);
+	adxl345_worker_utilization(adxl);
+
+	if (!READ_ONCE(adxl->stream_users) || !READ_ONCE(adxl->polling))
+		return;
+
+	/*
+	 * Come back by the time the FIFO reaches its watermark. A jiffy can
+	 * be longer than the whole FIFO at 3200 Hz, so this takes an hrtimer,
+	 * allowed one sample of slack to coalesce with other wakeups.
+	 */
+	hrtimer_start_range_ns(&adxl->poll_timer,
+			       ns_to_ktime(period * ADXL345_FIFO_WATERMARK),
+			       period, HRTIMER_MODE_REL);
+}
+
+/* Called with lock held, drains right away and then every watermark */
+static void adxl345_start_polling(struct adxl_device *adxl)
+{
+	WRITE_ONCE(adxl->polling, true);
+	kthread_queue_work(adxl->worker, &adxl->poll_work);
+}
+
+/*
+ * The timer queues the work and the work arms the timer. Once polling is
+ * off, a work already running may still arm the timer and that may still
+ * queue a work, which would find polling off. The second cancel makes
+ * sure none is left queued when this returns.
+ */
+static void adxl345_stop_polling(struct adxl_device *adxl)
+{
+	WRITE_ONCE(adxl->polling, false);
+	kthread_cancel_work_sync(&adxl->poll_work);
+	hrtimer_cancel(&adxl->poll_timer);
+	kthread_cancel_work_sync(&adxl->poll_work);
+}
+
+int adxl345_set_worker_cpu(struct adxl_device *adxl, int cpu)
+{
+	int ret;
+
+	if (cpu >= (int)nr_cpu_ids || (cpu >= 0 && !cpu_online(cpu)))
+		return -EINVAL;
+
+	mutex_lock(&adxl->lock);
+	ret = set_cpus_allowed_ptr(adxl->worker->task,
+				   cpu < 0 ? cpu_possible_mask :
+					     cpumask_of(cpu));
+	if (!ret)
+		adxl->worker_cpu = cpu;
+	mutex_unlock(&adxl->lock);
+
+	return ret;
+}
+
+int adxl345_set_worker_priority(struct adxl_device *adxl, int policy,
+				int prio)
+{
+	struct task_struct *task = adxl->worker->task;
+
+	if (policy == SCHED_FIFO && prio != ADXL345_WORKER_FIFO &&
+	    prio != ADXL345_WORKER_FIFO_LOW)
+		return -EINVAL;
+	if (policy == SCHED_NORMAL && (prio < MIN_NICE || prio > MAX_NICE))
+		return -EINVAL;
+
+	mutex_lock(&adxl->lock);
+	if (policy == SCHED_NORMAL)
+		sched_set_normal(task, prio);
+	else if (prio == ADXL345_WORKER_FIFO)
+		sched_set_fifo(task);
+	else
+		sched_set_fifo_low(task);
+	adxl->worker_policy = policy;
+	adxl->worker_prio = prio;
+	mutex_unlock(&adxl->lock);
+
+	return 0;
+}
+
+/*
+ * Share of time spent draining over the last completed window, in
+ * permille. The worker rolls the window after each drain and readers roll
+ * it when the worker is idle, so reading never shortens a window.
+ */
+unsigned int adxl345_worker_utilization(struct adxl_device *adxl)
+{
+	s64 busy = atomic64_read(&adxl->busy_ns), now = ktime_get_ns();
+	unsigned int permille;
+
+	spin_lock(&adxl->util_lock);
+	if (now - adxl->util_time >= ADXL345_UTIL_WINDOW_NS) {
+		permille = div64_u64((u64)(busy - adxl->util_busy) * 1000,
+				     now - adxl->util_time);
+		adxl->util_permille = min(permille, 1000U);
+		adxl->util_busy = busy;
+		adxl->util_time = now;
+	}
+	permille = adxl->util_permille;
+	spin_unlock(&adxl->util_lock);
+
+	return permille;
+}
+
+int adxl345_pm_get(struct adxl_device *adxl)
+{
+	return pm_runtime_resume_and_get(adxl->dev);
+}
+
+void adxl345_pm_put(struct adxl_device *adxl)
+{
+	pm_runtime_mark_last_busy(adxl->dev);
+	pm_runtime_put_autosuspend(adxl->dev);
+}
+
+/* Called with ring_lock held, when is the time of the first valid sample */
+static void adxl345_note_resume(struct adxl_device *adxl, s64 when)
+{
+	if (adxl->resumed_at) {
+		adxl->resume_latency = max_t(s64, when - adxl->resumed_at, 0);
+		adxl->resumed_at = 0;
+	}
+}
+
+/* Reading clears latched events, keep them for the next drain to report */
+static int adxl345_read_source(struct adxl_device *adxl)
+{
+	unsigned int source;
+	int ret;
+
+	if ((ret = regmap_read(adxl->regmap, ADXL345_REG_INT_SOURCE, &source)))
+		return ret;
+
+	atomic_or(source & ADXL_EVENT_ALL, &adxl->latched);
+	return source;
+}
+
+/*
+ * The data registers hold stale values until the first conversion after
+ * a resume completes, wait for it rather than handing those out.
+ */
+static void adxl345_wait_ready(struct adxl_device *adxl)
+{
+	bool resuming;
+	int source;
+
+	spin_lock(&adxl->ring_lock);
+	resuming = adxl->resumed_at;
+	spin_unlock(&adxl->ring_lock);
+
+	if (!resuming || !(adxl->pm_regs[ADXL345_REG_POWER_CTL -
+					 ADXL345_REG_BW_RATE] &
+			   ADXL345_POWER_CTL_MEASURE))
+		return;
+
+	if (read_poll_timeout(adxl345_read_source, source,
+			      source < 0 || source & ADXL345_INT_DATA_READY,
+			      100, ADXL345_RESUME_TIMEOUT_US, false, adxl) ||
+	    source < 0)
+		return;
+
+	spin_lock(&adxl->ring_lock);
+	adxl345_note_resume(adxl, ktime_get_ns());
+	spin_unlock(&adxl->ring_lock);
+}
+
+static int adxl345_read_data(struct adxl_device *adxl, unsigned int reg,
+			     void *val, size_t len)
+{
+	int ret;
+
+	if ((ret = adxl345_pm_get(adxl)))
+		return ret;
+
+	adxl345_wait_ready(adxl);
+	ret = regmap_bulk_read(adxl->regmap, reg, val, len);
+
+	adxl345_pm_put(adxl);
+	return ret;
+}
+
+static int adxl345_write_power(struct adxl_device *adxl, unsigned int val)
+{
+	int ret;
+
+	if ((ret = adxl345_pm_get(adxl)))
+		return ret;
+
+	ret = regmap_write(adxl->regmap, ADXL345_REG_POWER_CTL, val);
+
+	adxl345_pm_put(adxl);
+	return ret;
+}
+
 int adxl345_enable(struct adxl_device *adxl)
 {
-	return regmap_write(adxl->regmap, ADXL345_REG_POWER_CTL,
-			    ADXL345_POWER_CTL_MEASURE);
+	return adxl345_write_power(adxl, ADXL345_POWER_CTL_MEASURE);
 }
 
 int adxl345_disable(struct adxl_device *adxl)
 {
-	return regmap_write(adxl->regmap, ADXL345_REG_POWER_CTL,
-			    ADXL345_POWER_CTL_STANDBY);
+	return adxl345_write_power(adxl, ADXL345_POWER_CTL_STANDBY);
 }
 
 int adxl345_read_range(struct adxl_device *adxl)
@@ -37,8 +278,19 @@ int adxl345_read_range(struct adxl_device *adxl)
 
 int adxl345_write_range(struct adxl_device *adxl, u8 range)
 {
-	int ret = regmap_update_bits(adxl->regmap, ADXL345_REG_DATA_FORMAT,
-				     ADXL345_DATA_FORMAT_RANGE, range);
+	int ret;
+
+	/* Suspend saves the configuration, so change it while awake */
+	if ((ret = adxl345_pm_get(adxl)))
+		return ret;
+
+	ret = regmap_update_bits(adxl->regmap, ADXL345_REG_DATA_FORMAT,
+				 ADXL345_DATA_FORMAT_RANGE, range);
+	adxl345_pm_put(adxl);
+	if (!ret)
+		adxl->data_format = (adxl->data_format &
+				     ~ADXL345_DATA_FORMAT_RANGE) |
+				    (range & ADXL345_DATA_FORMAT_RANGE);
 	return ret < 0 ? ret :
 			 (adxl->measurement_range = ADXL345_DATA_FORMAT_RANGE &
 						    range);
@@ -55,15 +307,24 @@ int adxl345_read_rate(struct adxl_device *adxl)
 
 int adxl345_write_rate(struct adxl_device *adxl, u8 rate)
 {
-	int ret = regmap_update_bits(adxl->regmap, ADXL345_REG_BW_RATE,
-				     ADXL345_BW_RATE, rate);
-	return ret < 0 ? ret : (adxl->sample_rate = ADXL345_REG_BW_RATE & rate);
+	int ret;
+
+	if ((ret = adxl345_pm_get(adxl)))
+		return ret;
+
+	ret = regmap_update_bits(adxl->regmap, ADXL345_REG_BW_RATE,
+				 ADXL345_BW_RATE, rate);
+	adxl345_pm_put(adxl);
+	return ret < 0 ? ret : (adxl->sample_rate = ADXL345_BW_RATE & rate);
 }
 
 int adxl345_read_x(struct adxl_device *adxl)
 {
-	int ret = regmap_bulk_read(adxl->regmap, ADXL345_REG_DATAX0,
-				   (s16 *)&adxl->x, 2);
+	if (READ_ONCE(adxl->stream_users))
+		return adxl345_update_axis(adxl);
+
+	int ret = adxl345_read_data(adxl, ADXL345_REG_DATAX0,
+				    (s16 *)&adxl->x, 2);
 	if (ret < 0)
 		return ret;
 	return 0;
@@ -71,8 +332,11 @@ int adxl345_read_x(struct adxl_device *adxl)
 
 int adxl345_read_y(struct adxl_device *adxl)
 {
-	int ret = regmap_bulk_read(adxl->regmap, ADXL345_REG_DATAY0,
-				   (s16 *)&adxl->y, 2);
+	if (READ_ONCE(adxl->stream_users))
+		return adxl345_update_axis(adxl);
+
+	int ret = adxl345_read_data(adxl, ADXL345_REG_DATAY0,
+				    (s16 *)&adxl->y, 2);
 	if (ret < 0)
 		return ret;
 	return 0;
@@ -80,8 +344,11 @@ int adxl345_read_y(struct adxl_device *adxl)
 
 int adxl345_read_z(struct adxl_device *adxl)
 {
-	int ret = regmap_bulk_read(adxl->regmap, ADXL345_REG_DATAZ0,
-				   (s16 *)&adxl->z, 2);
+	if (READ_ONCE(adxl->stream_users))
+		return adxl345_update_axis(adxl);
+
+	int ret = adxl345_read_data(adxl, ADXL345_REG_DATAZ0,
+				    (s16 *)&adxl->z, 2);
 	if (ret < 0)
 		return ret;
 	return 0;
@@ -90,29 +357,633 @@ int adxl345_read_z(struct adxl_device *adxl)
 int adxl345_update_axis(struct adxl_device *adxl)
 {
 	int ret;
+	s16 x, y, z;
 	u8 xyz_val[6];
-	if ((ret = regmap_bulk_read(adxl->regmap, ADXL345_REG_DATAX0, xyz_val,
-				    sizeof(xyz_val)))) {
-		dev_dbg(&adxl->spidev->dev, "Failed to update axis\n");
+
+	/*
+	 * Reading the data registers pops the FIFO while streaming, take
+	 * the newest drained sample instead of stealing one from the ring.
+	 */
+	if (READ_ONCE(adxl->stream_users)) {
+		ret = adxl345_drain_fifo(adxl);
+		return ret < 0 ? ret : 0;
+	}
+
+	if ((ret = adxl345_read_data(adxl, ADXL345_REG_DATAX0, xyz_val,
+				     sizeof(xyz_val)))) {
+		dev_dbg(adxl->dev, "Failed to update axis\n");
 		return ret;
 	}
 
-	adxl->x = (int16_t)((xyz_val[1] << 8) | xyz_val[0]);
-	adxl->y = (int16_t)((xyz_val[3] << 8) | xyz_val[2]);
-	adxl->z = (int16_t)((xyz_val[5] << 8) | xyz_val[4]);
+	adxl345_decode(xyz_val, &x, &y, &z);
+	adxl->x = x;
+	adxl->y = y;
+	adxl->z = z;
 
 	return 0;
 }
 
+/* Called with ring_lock held, returns true when a window was published */
+static bool adxl345_stats_add(struct adxl_device *adxl,
+			      const struct adxl_sample *sample)
+{
+	struct adxl_stats *acc = &adxl->stats_acc;
+	s16 val[3] = { sample->x, sample->y, sample->z };
+	bool published = false;
+	int i;
+
+	if (acc->count && sample->timestamp - acc->start >=
+				  (s64)adxl->stats_window_ns) {
+		acc->seq = adxl->stats_seq++;
+		for (i = 0; i < 3; i++)
+			acc->mean[i] = div_s64(acc->sum[i] * 256, acc->count);
+		adxl->stats = *acc;
+		memset(acc, 0, sizeof(*acc));
+		published = true;
+	}
+
+	if (!acc->count) {
+		acc->start = sample->timestamp;
+		for (i = 0; i < 3; i++)
+			acc->min[i] = acc->max[i] = val[i];
+	}
+
+	acc->end = sample->timestamp;
+	acc->count++;
+	for (i = 0; i < 3; i++) {
+		acc->min[i] = min(acc->min[i], val[i]);
+		acc->max[i] = max(acc->max[i], val[i]);
+		acc->sum[i] += val[i];
+		acc->sumsq[i] += (s32)val[i] * val[i];
+	}
+
+	return published;
+}
+
+static u32 adxl345_period_to_mhz(u64 period_q16)
+{
+	return div64_u64((u64)NSEC_PER_SEC * MSEC_PER_SEC << 16, period_q16);
+}
+
+/*
+ * Called with fifo_lock held after draining n samples found at now. The
+ * drained count over a few seconds, and at least ADXL345_DRIFT_MIN_SAMPLES
+ * samples, of drain timestamps gives the actual sample period, whose
+ * jitter the IIR filter then smooths out.
+ */
+static void adxl345_track_drift(struct adxl_device *adxl, s64 now, int n)
+{
+	u64 nominal = ADXL345_RATE_PERIOD_NS(adxl->sample_rate) << 16;
+	u64 measured;
+
+	if (adxl->drift_rate != adxl->sample_rate) {
+		adxl->drift_rate = adxl->sample_rate;
+		adxl->period_q16 = nominal;
+		adxl->drift_anchor = 0;
+		WRITE_ONCE(adxl->shared->odr_mhz,
+			   adxl345_period_to_mhz(nominal));
+	}
+
+	/* A full FIFO may have overflowed, so the count no longer adds up */
+	if (!adxl->drift_anchor || n >= ADXL345_FIFO_SIZE) {
+		adxl->drift_anchor = now;
+		adxl->drift_count = 0;
+		return;
+	}
+
+	adxl->drift_count += n;
+	if (now - adxl->drift_anchor < ADXL345_DRIFT_INTERVAL_NS ||
+	    adxl->drift_count < ADXL345_DRIFT_MIN_SAMPLES)
+		return;
+
+	measured = div64_u64((u64)(now - adxl->drift_anchor) << 16,
+			     adxl->drift_count);
+	adxl->drift_anchor = now;
+	adxl->drift_count = 0;
+
+	if (measured < nominal - nominal / ADXL345_DRIFT_MAX_DIV ||
+	    measured > nominal + nominal / ADXL345_DRIFT_MAX_DIV)
+		return;
+
+	adxl->period_q16 += (measured >> ADXL345_DRIFT_IIR_SHIFT) -
+			    (adxl->period_q16 >> ADXL345_DRIFT_IIR_SHIFT);
+	WRITE_ONCE(adxl->shared->odr_mhz,
+		   adxl345_period_to_mhz(adxl->period_q16));
+}
+
+void adxl345_get_odr(struct adxl_device *adxl, u32 *mhz, s32 *ppm)
+{
+	u64 nominal, period;
+
+	mutex_lock(&adxl->fifo_lock);
+	nominal = ADXL345_RATE_PERIOD_NS(adxl->sample_rate) << 16;
+	period = adxl->drift_rate == adxl->sample_rate ? adxl->period_q16 :
+							  nominal;
+	mutex_unlock(&adxl->fifo_lock);
+
+	*mhz = adxl345_period_to_mhz(period);
+	/* Positive when the sensor runs faster than its nominal rate */
+	*ppm = div64_s64((s64)(nominal - period),
+			 div64_u64(period, 1000000));
+}
+
+/* Called with ring_lock held, keeps the n entries just drained as read */
+static void adxl345_raw_add(struct adxl_device *adxl, s64 first, int n)
+{
+	struct adxl_raw_slot *slot =
+		&adxl->raw_ring[adxl->raw_head & (ADXL_RAW_SLOTS - 1)];
+
+	slot->hdr = (struct adxl_raw_burst){
+		.timestamp = first,
+		.odr_mhz = adxl->shared->odr_mhz,
+		.seq = adxl->drained,
+		.count = n,
+		.data_format = adxl->data_format,
+	};
+	memcpy(slot->data, adxl->fifo_buf, n * ADXL345_SAMPLE_SIZE);
+	adxl->raw_head++;
+}
+
+int adxl345_drain_fifo(struct adxl_device *adxl)
+{
+	struct adxl_sample *sample;
+	bool published = false, decode;
+	unsigned int status;
+	u32 events, first;
+	int ret, i, n;
+	s64 now, period;
+	s16 x, y, z;
+
+	mutex_lock(&adxl->fifo_lock);
+
+	/* Everything counted by FIFO_STATUS was sampled by now */
+	now = ktime_get_ns();
+
+	/*
+	 * Reading INT_SOURCE clears latched events. Leave them unless heard,
+	 * or enabled, so a late subscriber does not get stale ones.
+	 */
+	if ((READ_ONCE(adxl->events) ||
+	     adxl_netlink_listening(ADXL_NL_EVENTS)) &&
+	    (ret = adxl345_read_source(adxl)) < 0)
+		goto out;
+	events = atomic_xchg(&adxl->latched, 0);
+
+	if ((ret = regmap_read(adxl->regmap, ADXL345_REG_FIFO_STATUS,
+			       &status)))
+		goto out;
+
+	n = min_t(int, status & ADXL345_FIFO_STATUS_ENTRIES,
+		  ADXL345_FIFO_SIZE);
+
+	/* Each 6-byte burst of the data registers pops one FIFO entry */
+	for (i = 0; i < n; i++) {
+		if ((ret = regmap_bulk_read(
+			     adxl->regmap, ADXL345_REG_DATAX0,
+			     adxl->fifo_buf + i * ADXL345_SAMPLE_SIZE,
+			     ADXL345_SAMPLE_SIZE))) {
+			dev_dbg(adxl->dev, "Failed to drain FIFO\n");
+			goto out;
+		}
+	}
+
+	adxl345_track_drift(adxl, now, n);
+	period = adxl->period_q16 >> 16;
+
+	/* With raw streams only, decoding is left to userspace */
+	decode = READ_ONCE(adxl->stream_users) > READ_ONCE(adxl->raw_users);
+
+	spin_lock(&adxl->ring_lock);
+
+	if (n && READ_ONCE(adxl->raw_users))
+		adxl345_raw_add(adxl, now - (n - 1) * period, n);
+	first = adxl->drained;
+	adxl->drained += n;
+
+	/* Warn mmap consumers off the slots about to be rewritten */
+	if (decode) {
+		WRITE_ONCE(adxl->shared->reserve, adxl->head + n);
+		smp_wmb();
+	}
+
+	for (i = 0; decode && i < n; i++) {
+		sample = &adxl->ring[adxl->head & (ADXL_RING_SIZE - 1)];
+		/* Newest entry sampled about now, older ones a period apart */
+		sample->timestamp = now - (n - 1 - i) * period;
+		sample->seq = first + i;
+		adxl->head++;
+		adxl345_decode(adxl->fifo_buf + i * ADXL345_SAMPLE_SIZE,
+			       &sample->x, &sample->y, &sample->z);
+		if (adxl->stats_window_ns)
+			published |= adxl345_stats_add(adxl, sample);
+	}
+
+	smp_store_release(&adxl->shared->head, adxl->head);
+	if (n)
+		adxl345_note_resume(adxl, now - (n - 1) * period);
+	spin_unlock(&adxl->ring_lock);
+
+	if (n) {
+		adxl345_decode(adxl->fifo_buf + (n - 1) * ADXL345_SAMPLE_SIZE,
+			       &x, &y, &z);
+		adxl->x = x;
+		adxl->y = y;
+		adxl->z = z;
+		wake_up_interruptible(&adxl->wq);
+		if (decode && READ_ONCE(adxl->iio_buffered))
+			adxl_iio_push(adxl, adxl->head - n, n);
+	}
+
+	/* Lets agents poll(2) the stats attribute instead of the samples */
+	if (published) {
+		/* Devices made by the KUnit suite have no class device */
+		if (adxl->device)
+			sysfs_notify(&adxl->device->kobj, NULL, "stats");
+		if (adxl_netlink_listening(ADXL_NL_SUMMARIES))
+			adxl_netlink_summary(adxl);
+	}
+
+	if (events && adxl_netlink_listening(ADXL_NL_EVENTS))
+		adxl_netlink_event(adxl, now, first, events);
+
+	ret = n;
+out:
+	mutex_unlock(&adxl->fifo_lock);
+	return ret;
+}
+
+int adxl345_fetch_samples(struct adxl_device *adxl, u32 *tail,
+			  struct adxl_sample *out, int max)
+{
+	int i, n;
+
+	spin_lock(&adxl->ring_lock);
+
+	/* The reader fell behind and got overwritten, skip to the oldest */
+	if (adxl->head - *tail > ADXL_RING_SIZE)
+		*tail = adxl->head - ADXL_RING_SIZE;
+
+	n = min_t(u32, adxl->head - *tail, max);
+	for (i = 0; i < n; i++)
+		out[i] = adxl->ring[(*tail + i) & (ADXL_RING_SIZE - 1)];
+	*tail += n;
+
+	spin_unlock(&adxl->ring_lock);
+	return n;
+}
+
+bool adxl345_samples_pending(struct adxl_device *adxl, u32 tail)
+{
+	return READ_ONCE(adxl->head) != tail;
+}
+
+int adxl345_raw_start(struct adxl_device *adxl)
+{
+	int ret;
+
+	if ((ret = adxl345_stream_start(adxl)))
+		return ret;
+
+	mutex_lock(&adxl->lock);
+	adxl->raw_users++;
+	mutex_unlock(&adxl->lock);
+	return 0;
+}
+
+void adxl345_raw_stop(struct adxl_device *adxl)
+{
+	mutex_lock(&adxl->lock);
+	adxl->raw_users--;
+	mutex_unlock(&adxl->lock);
+
+	adxl345_stream_stop(adxl);
+}
+
+/*
+ * Copy as many whole drains from slot *tail on as fit in len bytes, each
+ * its header and hdr.count samples. Returns the number of bytes copied.
+ */
+size_t adxl345_fetch_raw(struct adxl_device *adxl, u32 *tail, void *out,
+			 size_t len)
+{
+	struct adxl_raw_slot *slot;
+	size_t copied = 0, bytes;
+	bool lost = false;
+
+	spin_lock(&adxl->ring_lock);
+
+	/* The reader fell behind and got overwritten, skip to the oldest */
+	if (adxl->raw_head - *tail > ADXL_RAW_SLOTS) {
+		*tail = adxl->raw_head - ADXL_RAW_SLOTS;
+		lost = true;
+	}
+
+	for (; *tail != adxl->raw_head; (*tail)++) {
+		slot = &adxl->raw_ring[*tail & (ADXL_RAW_SLOTS - 1)];
+		bytes = sizeof(slot->hdr) +
+			slot->hdr.count * ADXL345_SAMPLE_SIZE;
+		if (copied + bytes > len)
+			break;
+
+		memcpy(out + copied, slot, bytes);
+		if (lost) {
+			((struct adxl_raw_burst *)(out + copied))->flags |=
+				ADXL_RAW_LOST;
+			lost = false;
+		}
+		copied += bytes;
+	}
+
+	spin_unlock(&adxl->ring_lock);
+	return copied;
+}
+
+bool adxl345_raw_pending(struct adxl_device *adxl, u32 tail)
+{
+	return READ_ONCE(adxl->raw_head) != tail;
+}
+
+/* A window length enables statistics, which keep the sensor streaming */
+int adxl345_set_stats_window(struct adxl_device *adxl, unsigned int ms)
+{
+	int ret = 0;
+
+	if (ms > ADXL345_STATS_WINDOW_MAX_MS)
+		return -EINVAL;
+
+	mutex_lock(&adxl->stats_lock);
+
+	if (ms && !adxl->stats_window_ms &&
+	    (ret = adxl345_stream_start(adxl)))
+		goto out;
+
+	spin_lock(&adxl->ring_lock);
+	adxl->stats_window_ns = (u64)ms * NSEC_PER_MSEC;
+	memset(&adxl->stats_acc, 0, sizeof(adxl->stats_acc));
+	spin_unlock(&adxl->ring_lock);
+
+	if (!ms && adxl->stats_window_ms)
+		adxl345_stream_stop(adxl);
+
+	adxl->stats_window_ms = ms;
+out:
+	mutex_unlock(&adxl->stats_lock);
+	return ret;
+}
+
+/*
+ * Enabled events keep the sensor streaming like statistics do, since only
+ * FIFO drains read INT_SOURCE. Overruns are always reported and cannot be
+ * switched.
+ */
+int adxl345_set_events(struct adxl_device *adxl, unsigned int events)
+{
+	int ret = 0;
+
+	if (events & ~ADXL345_INT_EVENTS)
+		return -EINVAL;
+
+	mutex_lock(&adxl->events_lock);
+	if (events == adxl->events)
+		goto out;
+
+	/* INT_ENABLE is only written awake, or resume would restore it */
+	if (!adxl->events && (ret = adxl345_stream_start(adxl)))
+		goto out;
+
+	if ((ret = regmap_update_bits(adxl->regmap, ADXL345_REG_INT_ENABLE,
+				      ADXL345_INT_EVENTS, events))) {
+		if (!adxl->events)
+			adxl345_stream_stop(adxl);
+		goto out;
+	}
+
+	if (!events)
+		adxl345_stream_stop(adxl);
+	WRITE_ONCE(adxl->events, events);
+out:
+	mutex_unlock(&adxl->events_lock);
+	return ret;
+}
+
+void adxl345_get_stats(struct adxl_device *adxl, struct adxl_stats *stats)
+{
+	spin_lock(&adxl->ring_lock);
+	*stats = adxl->stats;
+	spin_unlock(&adxl->ring_lock);
+}
+
+int adxl345_stream_start(struct adxl_device *adxl)
+{
+	int ret = 0;
+
+	mutex_lock(&adxl->lock);
+	if (adxl->stream_users++)
+		goto out;
+
+	/* Streams hold the sensor awake until the last one stops */
+	if ((ret = adxl345_pm_get(adxl))) {
+		adxl->stream_users--;
+		goto out;
+	}
+
+	if ((ret = adxl345_read_rate(adxl)) ||
+	    (ret = regmap_write(adxl->regmap, ADXL345_REG_FIFO_CTL,
+				ADXL345_FIFO_STREAM |
+					ADXL345_FIFO_WATERMARK)) ||
+	    (ret = adxl345_enable(adxl))) {
+		adxl->stream_users--;
+		adxl345_pm_put(adxl);
+		dev_dbg(adxl->dev, "Failed to start stream\n");
+		goto out;
+	}
+
+	/* Samples left from before would skew the drift count */
+	mutex_lock(&adxl->fifo_lock);
+	adxl->drift_anchor = 0;
+	mutex_unlock(&adxl->fifo_lock);
+	adxl345_start_polling(adxl);
+out:
+	mutex_unlock(&adxl->lock);
+	return ret;
+}
+
+void adxl345_stream_stop(struct adxl_device *adxl)
+{
+	mutex_lock(&adxl->lock);
+	if (!--adxl->stream_users) {
+		adxl345_stop_polling(adxl);
+		regmap_write(adxl->regmap, ADXL345_REG_FIFO_CTL,
+			     ADXL345_FIFO_BYPASS);
+		adxl345_pm_put(adxl);
+	}
+	mutex_unlock(&adxl->lock);
+}
+
+static int adxl345_runtime_suspend(struct device *dev)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	unsigned int data_format, fifo_ctl;
+	int ret;
+
+	/* Keep what resume needs to restore, then go to standby */
+	if ((ret = regmap_bulk_read(adxl->regmap, ADXL345_REG_BW_RATE,
+				    adxl->pm_regs, sizeof(adxl->pm_regs))) ||
+	    (ret = regmap_read(adxl->regmap, ADXL345_REG_DATA_FORMAT,
+			       &data_format)) ||
+	    (ret = regmap_read(adxl->regmap, ADXL345_REG_FIFO_CTL, &fifo_ctl)))
+		return ret;
+
+	adxl->pm_data_format = data_format;
+	adxl->pm_fifo_ctl = fifo_ctl;
+
+	return regmap_write(adxl->regmap, ADXL345_REG_POWER_CTL,
+			    ADXL345_POWER_CTL_STANDBY);
+}
+
+static int adxl345_runtime_resume(struct device *dev)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	int ret;
+
+	spin_lock(&adxl->ring_lock);
+	adxl->resumed_at = ktime_get_ns();
+	spin_unlock(&adxl->ring_lock);
+
+	/* Measurement starts with POWER_CTL in the final burst */
+	if ((ret = regmap_write(adxl->regmap, ADXL345_REG_DATA_FORMAT,
+				adxl->pm_data_format)) ||
+	    (ret = regmap_write(adxl->regmap, ADXL345_REG_FIFO_CTL,
+				adxl->pm_fifo_ctl)) ||
+	    (ret = regmap_bulk_write(adxl->regmap, ADXL345_REG_BW_RATE,
+				     adxl->pm_regs, sizeof(adxl->pm_regs)))) {
+		dev_dbg(dev, "Failed to restore configuration\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * System sleep forces the runtime suspend, but the worker is not frozen
+ * and would keep draining into a suspended bus. Stop it first and pick
+ * the stream up again on resume.
+ */
+static int adxl345_suspend(struct device *dev)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+
+	if (adxl->irq > 0)
+		disable_irq(adxl->irq);
+	adxl345_stop_polling(adxl);
+
+	return pm_runtime_force_suspend(dev);
+}
+
+static int adxl345_resume(struct device *dev)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	int ret;
+
+	if ((ret = pm_runtime_force_resume(dev)))
+		return ret;
+
+	mutex_lock(&adxl->lock);
+	if (adxl->stream_users)
+		adxl345_start_polling(adxl);
+	mutex_unlock(&adxl->lock);
+
+	if (adxl->irq > 0)
+		enable_irq(adxl->irq);
+	return 0;
+}
+
+const struct dev_pm_ops adxl345_pm_ops = {
+	SYSTEM_SLEEP_PM_OPS(adxl345_suspend, adxl345_resume)
+	RUNTIME_PM_OPS(adxl345_runtime_suspend, adxl345_runtime_resume, NULL)
+};
+
+static void adxl345_free_ring(void *shared)
+{
+	vfree(shared);
+}
+
+static void adxl345_destroy_worker(void *worker)
+{
+	kthread_destroy_worker(worker);
+}
+
 int adxl345_probe(struct adxl_device *adxl)
 {
-	struct spi_device *spidev = adxl->spidev;
-	struct device *dev = &spidev->dev;
+	struct device *dev = adxl->dev;
 	int ret;
 	u32 regval;
 
-	// 0. Regmap init
-	adxl->regmap = devm_regmap_init_spi(spidev, &regmap_spi_config);
+	adxl->probe_start = ktime_get_ns();
+
+	adxl->shared = vmalloc_user(ADXL_RING_BYTES);
+	if (!adxl->shared)
+		return -ENOMEM;
+
+	if ((ret = devm_add_action_or_reset(dev, adxl345_free_ring,
+					    adxl->shared)))
+		return ret;
+
+	adxl->shared->magic = ADXL_RING_MAGIC;
+	adxl->shared->size = ADXL_RING_SIZE;
+	adxl->shared->data_offset = sizeof(struct adxl_ring);
+	adxl->shared->sample_size = sizeof(struct adxl_sample);
+	adxl->ring = (void *)adxl->shared + adxl->shared->data_offset;
+
+	adxl->raw_ring = vzalloc(ADXL_RAW_SLOTS * sizeof(*adxl->raw_ring));
+	if (!adxl->raw_ring)
+		return -ENOMEM;
+
+	if ((ret = devm_add_action_or_reset(dev, adxl345_free_ring,
+					    adxl->raw_ring)))
+		return ret;
+
+	mutex_init(&adxl->lock);
+	mutex_init(&adxl->fifo_lock);
+	mutex_init(&adxl->stats_lock);
+	mutex_init(&adxl->events_lock);
+	spin_lock_init(&adxl->ring_lock);
+	spin_lock_init(&adxl->util_lock);
+	init_waitqueue_head(&adxl->wq);
+	kthread_init_work(&adxl->poll_work, adxl345_poll_work);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&adxl->poll_timer, adxl345_poll_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&adxl->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	adxl->poll_timer.function = adxl345_poll_timer;
+#endif
+	adxl->drift_rate = -1;
+
+	/*
+	 * One worker per sensor, so drains on different buses overlap. Since
+	 * v6.14 kthread_create_worker() leaves the thread asleep, it is woken
+	 * once its placement is set.
+	 */
+	adxl->worker = kthread_create_worker(0, "adxl/%s", dev_name(dev));
+	if (IS_ERR(adxl->worker))
+		return dev_err_probe(dev, PTR_ERR(adxl->worker),
+				     "Failed to create worker\n");
+
+	if ((ret = devm_add_action_or_reset(dev, adxl345_destroy_worker,
+					    adxl->worker)))
+		return ret;
+
+	/* Unbound at nice -20, like the high priority system workqueue */
+	adxl->worker_cpu = -1;
+	adxl345_set_worker_priority(adxl, SCHED_NORMAL, MIN_NICE);
+	wake_up_process(adxl->worker->task);
+	adxl->util_time = ktime_get_ns();
+
+	// 0. Regmap init, replay devices bring an emulated one
+	if (adxl->spidev)
+		adxl->regmap = devm_regmap_init_spi(adxl->spidev,
+						    &regmap_spi_config);
 	if (IS_ERR(adxl->regmap))
 		return dev_err_probe(dev, PTR_ERR(adxl->regmap),
 				     "Failed to initialize regmap\n");
@@ -127,31 +998,33 @@ int adxl345_probe(struct adxl_device *adxl)
 			"Invalid DEVID, received 0x%x, expected 0x%x\n", regval,
 			ADXL345_DEVID);
 
-	// 2. Set data format
+	// 2. Runtime PM, autosuspend to standby while nobody reads
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, ADXL345_AUTOSUSPEND_MS);
+	pm_runtime_use_autosuspend(dev);
+	if ((ret = devm_pm_runtime_enable(dev)))
+		return dev_err_probe(dev, ret, "Failed to enable runtime PM\n");
+
+	// 3. Set data format
 	if ((ret = regmap_write(adxl->regmap, ADXL345_REG_DATA_FORMAT,
 				ADXL345_DATA_FORMAT_FULL_RES)))
 		return dev_err_probe(dev, ret, "Failed to set data format\n");
+	adxl->data_format = ADXL345_DATA_FORMAT_FULL_RES;
+
+	/* The ODR and IIO sampling_frequency report this before any stream */
+	if ((ret = adxl345_read_rate(adxl)))
+		return dev_err_probe(dev, ret, "Failed to read rate\n");
 
-	// 3. Enable measurement
+	/* Event functions start from the datasheet's suggested settings */
+	if ((ret = regmap_multi_reg_write(adxl->regmap, adxl345_event_defaults,
+					  ARRAY_SIZE(adxl345_event_defaults))))
+		return dev_err_probe(dev, ret, "Failed to set up events\n");
+
+	// 4. Enable measurement
 	if ((ret = adxl345_enable(adxl)))
 		return dev_err_probe(dev, ret,
 				     "Failed to enable measurement\n");
 
-	// 4. Test if everything works!
-	if ((ret = adxl345_update_axis(adxl)) < 0)
-		return dev_err_probe(dev, ret, "Failed to read measurement\n");
-
-	dev_info(dev, "Read axes are x: %d, y: %d, z: %d during probe\n",
-		 adxl->x, adxl->y, adxl->z);
-
-	adxl345_read_y(adxl);
-	adxl345_read_x(adxl);
-	adxl345_read_z(adxl);
-
-	dev_info(dev,
-		 "Separate read axes are x: %d, y: %d, z: %d during probe\n",
-		 adxl->x, adxl->y, adxl->z);
-
 #ifdef ENABLE_INTERRUPT
 	adxl->irq = fwnode_irq_get_byname(dev_fwnode(dev), "INT1");
 	if (adxl->irq) {
@@ -169,11 +1042,45 @@ int adxl345_probe(struct adxl_device *adxl)
 	}
 
 	if ((ret = regmap_write(adxl->regmap, ADXL345_REG_INT_ENABLE,
-				ADXL345_INT_DATA_READY)))
+				ADXL345_INT_WATERMARK)))
 		return dev_err_probe(
 			dev, ret,
-			"Failed to enable interrupt for data ready\n");
+			"Failed to enable interrupt for FIFO watermark\n");
 #endif
 
+	// 5. IIO frontend, next to the character device
+	if ((ret = adxl_iio_probe(adxl)))
+		return dev_err_probe(dev, ret,
+				     "Failed to register IIO device\n");
+
 	return 0;
-}
\ No newline at end of file
+}
+
+/* Deferred from probe to the first open, proves the sensor produces data */
+int adxl345_check(struct adxl_device *adxl)
+{
+	int ret = 0;
+
+	mutex_lock(&adxl->lock);
+	if (adxl->checked)
+		goto out;
+
+	if ((ret = adxl345_update_axis(adxl)) < 0) {
+		dev_err(adxl->dev, "Failed to read measurement\n");
+		goto out;
+	}
+
+	dev_info(adxl->dev, "First read axes are x: %d, y: %d, z: %d\n",
+		 adxl->x, adxl->y, adxl->z);
+	adxl->checked = true;
+out:
+	mutex_unlock(&adxl->lock);
+	return ret;
+}
+
+void adxl345_remove(struct adxl_device *adxl)
+{
+	adxl345_set_events(adxl, 0);
+	adxl345_set_stats_window(adxl, 0);
+	adxl345_stop_polling(adxl);
+}
@@ -1,56 +1,376 @@
 #include "adxl.h"
 
+/* Per-open state */
+struct adxl_file {
+	struct adxl_device *adxl;
+	struct mutex read_lock; /* Serializes reads sharing this fd */
+	unsigned int gen; /* Bumped on mode and tail changes, wakes readers */
+	int mode;
+	u32 tail; /* Next ring position to read while streaming */
+	u32 raw_tail; /* Next drain to read in ADXL_MODE_RAW */
+	size_t len, pos; /* Formatted bytes in buf and consumed ones */
+	char *buf;
+	struct adxl_sample *batch;
+};
+
+static int adxl_set_mode(struct adxl_file *f, int mode)
+{
+	bool was_streaming = f->mode != ADXL_MODE_SINGLE;
+	bool was_raw = f->mode == ADXL_MODE_RAW;
+	int ret;
+
+	if (mode < ADXL_MODE_SINGLE || mode > ADXL_MODE_RAW)
+		return -EINVAL;
+
+	if (mode == f->mode)
+		return 0;
+
+	/* Raw streams are counted apart, they need no decoded samples */
+	if (mode == ADXL_MODE_RAW) {
+		if ((ret = adxl345_raw_start(f->adxl)))
+			return ret;
+		WRITE_ONCE(f->raw_tail, READ_ONCE(f->adxl->raw_head));
+	} else if (mode != ADXL_MODE_SINGLE && (!was_streaming || was_raw)) {
+		if ((ret = adxl345_stream_start(f->adxl)))
+			return ret;
+		WRITE_ONCE(f->tail, READ_ONCE(f->adxl->head));
+	}
+
+	if (was_raw)
+		adxl345_raw_stop(f->adxl);
+	else if (was_streaming &&
+		 (mode == ADXL_MODE_SINGLE || mode == ADXL_MODE_RAW))
+		adxl345_stream_stop(f->adxl);
+
+	WRITE_ONCE(f->mode, mode);
+	f->len = f->pos = 0;
+	return 0;
+}
+
 static int adxl_open(struct inode *inode, struct file *file)
 {
 	struct adxl_device *adxl =
 		container_of(inode->i_cdev, struct adxl_device, cdev);
+	struct adxl_file *f;
+	int ret;
 
-	file->private_data = adxl;
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
 
-	dev_dbg(&adxl->spidev->dev, "new fd opened\n");
+	f->buf = kvmalloc(ADXL_BUF_SIZE, GFP_KERNEL);
+	f->batch = kmalloc_array(ADXL_READ_BATCH, sizeof(*f->batch),
+				 GFP_KERNEL);
+	if (!f->buf || !f->batch) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	/* Wake the sensor now, it autosuspends again unless reads follow */
+	if ((ret = adxl345_pm_get(adxl)))
+		goto fail;
+	ret = adxl345_check(adxl);
+	adxl345_pm_put(adxl);
+	if (ret)
+		goto fail;
+
+	f->adxl = adxl;
+	f->mode = ADXL_MODE_SINGLE;
+	mutex_init(&f->read_lock);
+	if ((ret = adxl_set_mode(f, READ_ONCE(adxl->default_mode))))
+		goto fail;
+
+	file->private_data = f;
+	file->f_mode |= FMODE_NOWAIT;
+
+	dev_dbg(adxl->dev, "new fd opened\n");
 
 	return 0;
+
+fail:
+	kfree(f->batch);
+	kvfree(f->buf);
+	kfree(f);
+	return ret;
 }
 
 static int adxl_release(struct inode *inode, struct file *file)
 {
 	struct adxl_device *adxl =
 		container_of(inode->i_cdev, struct adxl_device, cdev);
+	struct adxl_file *f = file->private_data;
+
+	adxl_set_mode(f, ADXL_MODE_SINGLE);
+	kfree(f->batch);
+	kvfree(f->buf);
+	kfree(f);
 
-	dev_dbg(&adxl->spidev->dev, "fd released\n");
+	dev_dbg(adxl->dev, "fd released\n");
 
 	return 0;
 }
 
-static ssize_t adxl_read(struct file *file, char __user *ubuf, size_t len,
-			 loff_t *offset)
+/*
+ * A bus transfer rather than buffered data, only called without NOWAIT.
+ * Reading from offset 0 samples a new line, the rest of it follows at the
+ * advanced offset and then EOF, so cat(1) prints one line.
+ */
+static ssize_t adxl_read_single(struct adxl_file *f, struct iov_iter *to,
+				loff_t *offset)
 {
-	struct adxl_device *adxl = file->private_data;
+	struct adxl_device *adxl = f->adxl;
+	size_t len;
 
-	char *kbuf = kvmalloc(ADXL_BUF_SIZE, GFP_KERNEL);
-	if (!kbuf)
-		return kfree(kbuf), -ENOMEM;
+	if (!*offset) {
+		if (adxl345_update_axis(adxl) != 0)
+			return -EFAULT;
+		f->len = scnprintf(f->buf, ADXL_BUF_SIZE, "%d,%d,%d\n",
+				   adxl->x, adxl->y, adxl->z);
+	}
 
-	if (adxl345_update_axis(adxl) != 0)
-		return kfree(kbuf), -EFAULT;
+	if (*offset >= f->len)
+		return 0;
 
-	snprintf(kbuf, ADXL_BUF_SIZE, "%d,%d,%d\n", adxl->x, adxl->y, adxl->z);
+	len = umin(iov_iter_count(to), f->len - *offset);
 
-	if (*offset >= strlen(kbuf))
-		return kfree(kbuf), 0;
+	if (copy_to_iter(f->buf + *offset, len, to) != len)
+		return -EFAULT;
 
-	len = umin(len, strlen(kbuf) - *offset);
+	*offset += len;
+	return len;
+}
 
-	if (copy_to_user(ubuf, kbuf + *offset, len))
-		return kfree(kbuf), -EFAULT;
+/* Format the next batch of buffered samples, one line each */
+static size_t adxl_format_stream(struct adxl_file *f)
+{
+	int i, n;
 
-	kfree(kbuf);
-	return len;
+	n = adxl345_fetch_samples(f->adxl, &f->tail, f->batch,
+				  ADXL_READ_BATCH);
+
+	f->pos = f->len = 0;
+	for (i = 0; i < n; i++)
+		f->len += scnprintf(f->buf + f->len, ADXL_BUF_SIZE - f->len,
+				    "%lld,%u,%d,%d,%d\n",
+				    f->batch[i].timestamp, f->batch[i].seq,
+				    f->batch[i].x, f->batch[i].y,
+				    f->batch[i].z);
+
+	return f->len;
+}
+
+static bool adxl_file_pending(struct adxl_file *f)
+{
+	if (READ_ONCE(f->mode) == ADXL_MODE_RAW)
+		return adxl345_raw_pending(f->adxl, READ_ONCE(f->raw_tail));
+	return adxl345_samples_pending(f->adxl, READ_ONCE(f->tail));
+}
+
+/*
+ * Sleep without read_lock, so mode and tail changes from other threads of
+ * the fd are not held up until a sample arrives. Those bump gen, and the
+ * read restarts in whatever mode the fd is in now.
+ */
+static int adxl_wait_samples(struct adxl_file *f, bool nonblock)
+{
+	unsigned int gen = f->gen;
+	int ret;
+
+	if (nonblock)
+		return -EAGAIN;
+
+	mutex_unlock(&f->read_lock);
+	ret = wait_event_interruptible(f->adxl->wq,
+				       READ_ONCE(f->gen) != gen ||
+					       adxl_file_pending(f));
+	mutex_lock(&f->read_lock);
+
+	if (!ret && f->gen != gen)
+		ret = -EAGAIN;
+	return ret;
+}
+
+static ssize_t adxl_read_stream(struct adxl_file *f, struct iov_iter *to,
+				bool nonblock)
+{
+	size_t len = iov_iter_count(to), copied = 0, chunk;
+	int ret;
+
+	while (copied < len) {
+		if (f->pos == f->len && !adxl_format_stream(f)) {
+			/* Hand out whatever is ready before blocking */
+			if (copied)
+				break;
+			if ((ret = adxl_wait_samples(f, nonblock)))
+				return ret;
+			continue;
+		}
+
+		chunk = umin(len - copied, f->len - f->pos);
+		if (copy_to_iter(f->buf + f->pos, chunk, to) != chunk)
+			return copied ? copied : -EFAULT;
+
+		f->pos += chunk;
+		copied += chunk;
+	}
+
+	return copied;
+}
+
+/* Copy whole struct adxl_sample records, as many as are buffered */
+static ssize_t adxl_read_binary(struct adxl_file *f, struct iov_iter *to,
+				bool nonblock)
+{
+	size_t max = iov_iter_count(to) / sizeof(struct adxl_sample);
+	size_t copied = 0, bytes;
+	int ret, n;
+
+	if (!max)
+		return -EINVAL;
+
+	while (copied < max) {
+		n = adxl345_fetch_samples(f->adxl, &f->tail, f->batch,
+					  min_t(size_t, max - copied,
+						ADXL_READ_BATCH));
+		if (!n) {
+			if (copied)
+				break;
+			if ((ret = adxl_wait_samples(f, nonblock)))
+				return ret;
+			continue;
+		}
+
+		bytes = n * sizeof(struct adxl_sample);
+		if (copy_to_iter(f->batch, bytes, to) != bytes)
+			return copied ? copied * sizeof(struct adxl_sample) :
+					-EFAULT;
+		copied += n;
+	}
+
+	return copied * sizeof(struct adxl_sample);
+}
+
+/* Copy whole FIFO drains, each a struct adxl_raw_burst and its samples */
+static ssize_t adxl_read_raw(struct adxl_file *f, struct iov_iter *to,
+			     bool nonblock)
+{
+	size_t len = iov_iter_count(to), copied = 0, bytes;
+	int ret;
+
+	if (len < ADXL_RAW_BURST_MAX)
+		return -EINVAL;
+
+	while (len - copied >= ADXL_RAW_BURST_MAX) {
+		bytes = adxl345_fetch_raw(f->adxl, &f->raw_tail, f->buf,
+					  umin(len - copied, ADXL_BUF_SIZE));
+		if (!bytes) {
+			if (copied)
+				break;
+			if ((ret = adxl_wait_samples(f, nonblock)))
+				return ret;
+			continue;
+		}
+
+		if (copy_to_iter(f->buf, bytes, to) != bytes)
+			return copied ? copied : -EFAULT;
+		copied += bytes;
+	}
+
+	return copied;
+}
+
+/*
+ * Streaming reads only copy what the drain already buffered, so NOWAIT
+ * callers such as io_uring get -EAGAIN and wait on poll() readiness.
+ */
+static ssize_t adxl_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct adxl_file *f = file->private_data;
+	bool nonblock = (iocb->ki_flags & IOCB_NOWAIT) ||
+			(file->f_flags & O_NONBLOCK);
+	ssize_t ret;
+
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!mutex_trylock(&f->read_lock))
+			return -EAGAIN;
+	} else if (mutex_lock_interruptible(&f->read_lock)) {
+		return -ERESTARTSYS;
+	}
+
+	/* Blocking reads only see -EAGAIN when the mode or tail changed */
+	do {
+		if (f->mode == ADXL_MODE_STREAM)
+			ret = adxl_read_stream(f, to, nonblock);
+		else if (f->mode == ADXL_MODE_BINARY)
+			ret = adxl_read_binary(f, to, nonblock);
+		else if (f->mode == ADXL_MODE_RAW)
+			ret = adxl_read_raw(f, to, nonblock);
+		else if (iocb->ki_flags & IOCB_NOWAIT)
+			/* SPI, maybe behind a resume: let io_uring punt */
+			ret = -EAGAIN;
+		else
+			ret = adxl_read_single(f, to, &iocb->ki_pos);
+	} while (ret == -EAGAIN && !nonblock);
+
+	mutex_unlock(&f->read_lock);
+	return ret;
+}
+
+/* Replay devices take struct adxl_sample records to play back */
+static ssize_t adxl_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct adxl_file *f = file->private_data;
+
+	if (!f->adxl->replay)
+		return -EINVAL;
+
+	return adxl_replay_write(f->adxl, from,
+				 (iocb->ki_flags & IOCB_NOWAIT) ||
+					 (file->f_flags & O_NONBLOCK));
+}
+
+static __poll_t adxl_poll(struct file *file, poll_table *wait)
+{
+	struct adxl_file *f = file->private_data;
+
+	if (f->mode == ADXL_MODE_SINGLE)
+		return EPOLLIN | EPOLLRDNORM;
+
+	poll_wait(file, &f->adxl->wq, wait);
+
+	if (f->mode == ADXL_MODE_RAW)
+		return adxl345_raw_pending(f->adxl, f->raw_tail) ?
+			       EPOLLIN | EPOLLRDNORM :
+			       0;
+
+	if (f->pos < f->len || adxl345_samples_pending(f->adxl, f->tail))
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+/* Map the sample ring read-only, see struct adxl_ring */
+static int adxl_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct adxl_file *f = file->private_data;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	return remap_vmalloc_range(vma, f->adxl->shared, vma->vm_pgoff);
 }
 
 static long adxl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	struct adxl_device *dev = file->private_data;
+	struct adxl_file *f = file->private_data;
+	struct adxl_device *dev = f->adxl;
+	struct adxl_stats stats;
+	long ret;
+	u32 tail;
 
 	if (_IOC_TYPE(cmd) != ADXL_MAGIC || _IOC_NR(cmd) > ADXL_MAXNR)
 		return -ENOTTY;
@@ -71,23 +391,21 @@ static long adxl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		if (adxl345_read_rate(dev) < 0 ||
 		    put_user(dev->sample_rate, (int __user *)arg))
 			return -EFAULT;
-		dev_dbg(&dev->spidev->dev, "ioctl_get_rate %d\n",
-			dev->sample_rate);
+		dev_dbg(dev->dev, "ioctl_get_rate %d\n", dev->sample_rate);
 		break;
 
 	case ADXL_IOCTL_SET_RATE:
 		if (get_user(tmpval, (int __user *)arg) ||
 		    adxl345_write_rate(dev, tmpval) < 0)
 			return -EFAULT;
-		dev_dbg(&dev->spidev->dev, "ioctl_set_rate %d\n",
-			dev->sample_rate);
+		dev_dbg(dev->dev, "ioctl_set_rate %d\n", dev->sample_rate);
 		break;
 
 	case ADXL_IOCTL_GET_RANGE:
 		if (adxl345_read_range(dev) < 0 ||
 		    put_user(dev->measurement_range, (int __user *)arg))
 			return -EFAULT;
-		dev_dbg(&dev->spidev->dev, "ioctl_get_range %d\n",
+		dev_dbg(dev->dev, "ioctl_get_range %d\n",
 			dev->measurement_range);
 		break;
 
@@ -95,10 +413,46 @@ static long adxl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		if (get_user(tmpval, (int __user *)arg) ||
 		    adxl345_write_range(dev, tmpval) < 0)
 			return -EFAULT;
-		dev_dbg(&dev->spidev->dev, "ioctl_set_range %d\n",
+		dev_dbg(dev->dev, "ioctl_set_range %d\n",
 			dev->measurement_range);
 		break;
 
+	case ADXL_IOCTL_GET_MODE:
+		if (put_user(f->mode, (int __user *)arg))
+			return -EFAULT;
+		break;
+
+	case ADXL_IOCTL_SET_TAIL:
+		if (get_user(tail, (__u32 __user *)arg))
+			return -EFAULT;
+		/* Reads copying own the tail and buffer, sleeping ones not */
+		if (mutex_lock_interruptible(&f->read_lock))
+			return -ERESTARTSYS;
+		WRITE_ONCE(f->tail, tail);
+		f->len = f->pos = 0;
+		WRITE_ONCE(f->gen, f->gen + 1);
+		mutex_unlock(&f->read_lock);
+		wake_up_interruptible(&dev->wq);
+		break;
+
+	case ADXL_IOCTL_GET_STATS:
+		adxl345_get_stats(dev, &stats);
+		if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+			return -EFAULT;
+		break;
+
+	case ADXL_IOCTL_SET_MODE:
+		if (get_user(tmpval, (int __user *)arg))
+			return -EFAULT;
+		dev_dbg(dev->dev, "ioctl_set_mode %d\n", tmpval);
+		if (mutex_lock_interruptible(&f->read_lock))
+			return -ERESTARTSYS;
+		if (!(ret = adxl_set_mode(f, tmpval)))
+			WRITE_ONCE(f->gen, f->gen + 1);
+		mutex_unlock(&f->read_lock);
+		wake_up_interruptible(&dev->wq);
+		return ret;
+
 	default:
 		return -EINVAL;
 	}
@@ -109,6 +463,9 @@ struct file_operations adxl_fops = {
 	.owner = THIS_MODULE,
 	.open = adxl_open,
 	.release = adxl_release,
-	.read = adxl_read,
+	.read_iter = adxl_read_iter,
+	.write_iter = adxl_write_iter,
+	.poll = adxl_poll,
+	.mmap = adxl_mmap,
 	.unlocked_ioctl = adxl_ioctl,
 };
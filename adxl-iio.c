@@ -0,0 +1,223 @@
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/kfifo_buf.h>
+
+#include "adxl.h"
+
+/*
+ * IIO frontend, registered next to /dev/adxlN for libiio and the standard
+ * IIO tools. Its buffer is a kfifo the FIFO drain pushes every sample into,
+ * whether the poll worker or the watermark interrupt ran it. The device
+ * always pushes full x, y, z, timestamp scans; the IIO core demuxes them
+ * for consumers that enabled a subset of the channels.
+ */
+
+/* 3.9 mg per LSB in full resolution, in nm/s^2 */
+#define ADXL_IIO_SCALE_NANO_MS2 38245935
+
+/* iio_device_claim_direct() replaced the _mode() variants in v6.15 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 15, 0)
+static inline bool iio_device_claim_direct(struct iio_dev *indio_dev)
+{
+	return !iio_device_claim_direct_mode(indio_dev);
+}
+
+static inline void iio_device_release_direct(struct iio_dev *indio_dev)
+{
+	iio_device_release_direct_mode(indio_dev);
+}
+#endif
+
+#define ADXL_IIO_ACCEL(axis, index)                                           \
+	{                                                                     \
+		.type = IIO_ACCEL, .modified = 1, .channel2 = IIO_MOD_##axis, \
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),                 \
+		.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),         \
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),      \
+		.info_mask_shared_by_all_available =                          \
+			BIT(IIO_CHAN_INFO_SAMP_FREQ),                         \
+		.scan_index = index,                                          \
+		.scan_type = {                                                \
+			.sign = 's',                                          \
+			.realbits = 13,                                       \
+			.storagebits = 16,                                    \
+			.endianness = IIO_CPU,                                \
+		},                                                            \
+	}
+
+static const struct iio_chan_spec adxl_iio_channels[] = {
+	ADXL_IIO_ACCEL(X, 0),
+	ADXL_IIO_ACCEL(Y, 1),
+	ADXL_IIO_ACCEL(Z, 2),
+	IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+static const unsigned long adxl_iio_scan_masks[] = { GENMASK(2, 0), 0 };
+
+/* Hz and micro Hz of each BW_RATE code, 3200Hz halved per step down */
+static const int adxl_iio_freqs[][2] = {
+	{ 0, 97656 },  { 0, 195312 }, { 0, 390625 }, { 0, 781250 },
+	{ 1, 562500 }, { 3, 125000 }, { 6, 250000 }, { 12, 500000 },
+	{ 25, 0 },     { 50, 0 },     { 100, 0 },    { 200, 0 },
+	{ 400, 0 },    { 800, 0 },    { 1600, 0 },   { 3200, 0 },
+};
+
+static struct adxl_device *adxl_iio_priv(struct iio_dev *indio_dev)
+{
+	return *(struct adxl_device **)iio_priv(indio_dev);
+}
+
+static int adxl_iio_read_raw(struct iio_dev *indio_dev,
+			     struct iio_chan_spec const *chan, int *val,
+			     int *val2, long mask)
+{
+	struct adxl_device *adxl = adxl_iio_priv(indio_dev);
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		/* Bus reads would race the drain feeding an enabled buffer */
+		if (!iio_device_claim_direct(indio_dev))
+			return -EBUSY;
+		ret = adxl345_update_axis(adxl);
+		iio_device_release_direct(indio_dev);
+		if (ret)
+			return ret;
+		*val = chan->scan_index == 0 ? adxl->x :
+		       chan->scan_index == 1 ? adxl->y :
+					       adxl->z;
+		return IIO_VAL_INT;
+
+	case IIO_CHAN_INFO_SCALE:
+		*val = 0;
+		*val2 = ADXL_IIO_SCALE_NANO_MS2;
+		return IIO_VAL_INT_PLUS_NANO;
+
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		*val = adxl_iio_freqs[adxl->sample_rate][0];
+		*val2 = adxl_iio_freqs[adxl->sample_rate][1];
+		return IIO_VAL_INT_PLUS_MICRO;
+	}
+
+	return -EINVAL;
+}
+
+static int adxl_iio_write_raw(struct iio_dev *indio_dev,
+			      struct iio_chan_spec const *chan, int val,
+			      int val2, long mask)
+{
+	struct adxl_device *adxl = adxl_iio_priv(indio_dev);
+	int rate;
+
+	if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+		return -EINVAL;
+
+	for (rate = 0; rate < ARRAY_SIZE(adxl_iio_freqs); rate++) {
+		if (adxl_iio_freqs[rate][0] == val &&
+		    adxl_iio_freqs[rate][1] == val2) {
+			rate = adxl345_write_rate(adxl, rate);
+			return rate < 0 ? rate : 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int adxl_iio_read_avail(struct iio_dev *indio_dev,
+			       struct iio_chan_spec const *chan,
+			       const int **vals, int *type, int *length,
+			       long mask)
+{
+	if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+		return -EINVAL;
+
+	*vals = (const int *)adxl_iio_freqs;
+	*type = IIO_VAL_INT_PLUS_MICRO;
+	*length = ARRAY_SIZE(adxl_iio_freqs) * 2;
+	return IIO_AVAIL_LIST;
+}
+
+static const struct iio_info adxl_iio_info = {
+	.read_raw = adxl_iio_read_raw,
+	.write_raw = adxl_iio_write_raw,
+	.read_avail = adxl_iio_read_avail,
+};
+
+/* The buffer holds a stream like any open fd in a streaming mode */
+static int adxl_iio_preenable(struct iio_dev *indio_dev)
+{
+	return adxl345_stream_start(adxl_iio_priv(indio_dev));
+}
+
+static int adxl_iio_postenable(struct iio_dev *indio_dev)
+{
+	WRITE_ONCE(adxl_iio_priv(indio_dev)->iio_buffered, true);
+	return 0;
+}
+
+static int adxl_iio_predisable(struct iio_dev *indio_dev)
+{
+	WRITE_ONCE(adxl_iio_priv(indio_dev)->iio_buffered, false);
+	return 0;
+}
+
+static int adxl_iio_postdisable(struct iio_dev *indio_dev)
+{
+	adxl345_stream_stop(adxl_iio_priv(indio_dev));
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops adxl_iio_buffer_ops = {
+	.preenable = adxl_iio_preenable,
+	.postenable = adxl_iio_postenable,
+	.predisable = adxl_iio_predisable,
+	.postdisable = adxl_iio_postdisable,
+};
+
+/* Called with fifo_lock held, which keeps the n slots from seq stable */
+void adxl_iio_push(struct adxl_device *adxl, u32 seq, int n)
+{
+	struct {
+		s16 accel[3];
+		s64 timestamp __aligned(8);
+	} scan = {};
+	const struct adxl_sample *sample;
+	s64 offset;
+
+	/* Samples carry CLOCK_MONOTONIC, the IIO clock is per device */
+	offset = iio_get_time_ns(adxl->indio_dev) - ktime_get_ns();
+
+	for (; n--; seq++) {
+		sample = &adxl->ring[seq & (ADXL_RING_SIZE - 1)];
+		scan.accel[0] = sample->x;
+		scan.accel[1] = sample->y;
+		scan.accel[2] = sample->z;
+		iio_push_to_buffers_with_timestamp(adxl->indio_dev, &scan,
+						   sample->timestamp + offset);
+	}
+}
+
+int adxl_iio_probe(struct adxl_device *adxl)
+{
+	struct iio_dev *indio_dev;
+	int ret;
+
+	indio_dev = devm_iio_device_alloc(adxl->dev, sizeof(adxl));
+	if (!indio_dev)
+		return -ENOMEM;
+
+	*(struct adxl_device **)iio_priv(indio_dev) = adxl;
+	indio_dev->name = "adxl345";
+	indio_dev->info = &adxl_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = adxl_iio_channels;
+	indio_dev->num_channels = ARRAY_SIZE(adxl_iio_channels);
+	indio_dev->available_scan_masks = adxl_iio_scan_masks;
+
+	if ((ret = devm_iio_kfifo_buffer_setup(adxl->dev, indio_dev,
+					       &adxl_iio_buffer_ops)))
+		return ret;
+
+	adxl->indio_dev = indio_dev;
+	return devm_iio_device_register(adxl->dev, indio_dev);
+}
@@ -0,0 +1,106 @@
+#include <net/genetlink.h>
+
+#include "adxl.h"
+
+/*
+ * Generic netlink feed of events and statistics summaries for all devices,
+ * so local daemons share one socket instead of each opening every node.
+ * Messages are only built while the group has subscribers.
+ */
+
+static const struct genl_multicast_group adxl_nl_mcgrps[] = {
+	[ADXL_NL_EVENTS] = { .name = ADXL_GENL_MCGRP_EVENTS },
+	[ADXL_NL_SUMMARIES] = { .name = ADXL_GENL_MCGRP_SUMMARIES },
+};
+
+static struct genl_family adxl_nl_family __ro_after_init = {
+	.name = ADXL_GENL_NAME,
+	.version = ADXL_GENL_VERSION,
+	.maxattr = ADXL_ATTR_MAX,
+	.module = THIS_MODULE,
+	.mcgrps = adxl_nl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(adxl_nl_mcgrps),
+};
+
+bool adxl_netlink_listening(unsigned int group)
+{
+	return genl_has_listeners(&adxl_nl_family, &init_net, group);
+}
+
+static struct sk_buff *adxl_nl_new(struct adxl_device *adxl, u8 cmd,
+				   size_t payload, void **hdr)
+{
+	struct sk_buff *msg;
+
+	msg = genlmsg_new(nla_total_size(sizeof(u32)) + payload, GFP_KERNEL);
+	if (!msg)
+		return NULL;
+
+	*hdr = genlmsg_put(msg, 0, 0, &adxl_nl_family, 0, cmd);
+	if (!*hdr ||
+	    nla_put_u32(msg, ADXL_ATTR_DEVICE, MINOR(adxl->cdev.dev))) {
+		nlmsg_free(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+static void adxl_nl_send(struct sk_buff *msg, void *hdr, unsigned int group)
+{
+	genlmsg_end(msg, hdr);
+	genlmsg_multicast(&adxl_nl_family, msg, 0, group, GFP_KERNEL);
+}
+
+void adxl_netlink_event(struct adxl_device *adxl, s64 timestamp, u32 seq,
+			u32 events)
+{
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = adxl_nl_new(adxl, ADXL_CMD_EVENT,
+			  nla_total_size_64bit(sizeof(s64)) +
+				  2 * nla_total_size(sizeof(u32)),
+			  &hdr);
+	if (!msg)
+		return;
+
+	if (nla_put_s64(msg, ADXL_ATTR_TIMESTAMP, timestamp, ADXL_ATTR_PAD) ||
+	    nla_put_u32(msg, ADXL_ATTR_SEQ, seq) ||
+	    nla_put_u32(msg, ADXL_ATTR_EVENTS, events)) {
+		nlmsg_free(msg);
+		return;
+	}
+
+	adxl_nl_send(msg, hdr, ADXL_NL_EVENTS);
+}
+
+void adxl_netlink_summary(struct adxl_device *adxl)
+{
+	struct adxl_stats stats;
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = adxl_nl_new(adxl, ADXL_CMD_SUMMARY, nla_total_size(sizeof(stats)),
+			  &hdr);
+	if (!msg)
+		return;
+
+	adxl345_get_stats(adxl, &stats);
+	if (nla_put(msg, ADXL_ATTR_STATS, sizeof(stats), &stats)) {
+		nlmsg_free(msg);
+		return;
+	}
+
+	adxl_nl_send(msg, hdr, ADXL_NL_SUMMARIES);
+}
+
+int adxl_netlink_init(void)
+{
+	return genl_register_family(&adxl_nl_family);
+}
+
+void adxl_netlink_exit(void)
+{
+	genl_unregister_family(&adxl_nl_family);
+}
@@ -0,0 +1,379 @@
+#include <linux/platform_device.h>
+
+#include "adxl.h"
+
+/*
+ * Replay devices are extra /dev/adxlN nodes without a sensor behind them.
+ * They sit on an emulated ADXL345 register file instead of SPI, so the
+ * regular core, FIFO drain and fops paths run unchanged. Samples written
+ * to the node are queued and become visible through FIFO_STATUS and the
+ * data registers once due, paced by their recorded timestamps.
+ */
+
+#define ADXL_REPLAY_QUEUE 4096 /* Queued samples, power of 2 */
+
+static unsigned int replay_devices;
+module_param(replay_devices, uint, 0444);
+MODULE_PARM_DESC(replay_devices, "Number of replay /dev/adxlN to create");
+
+static struct platform_device *replay_pdevs[ADXL_MAX_DEVICES];
+
+struct adxl_replay {
+	struct adxl_device adxl;
+	struct mutex write_lock; /* Single producer of queue slots */
+	spinlock_t lock; /* Protects the queue indices and pacing anchors */
+	wait_queue_head_t wq; /* Writers waiting for room */
+	struct adxl_sample *queue;
+	u32 head, tail;
+	s64 anchor_sample, anchor_time; /* Sample timestamp due at time */
+	s64 standby_at; /* Playback clock stopped at, 0 while measuring */
+	unsigned int speed; /* 1 is real time, N is N times faster, 0 max */
+	u8 regs[ADXL345_REG_FIFO_STATUS + 1];
+	u8 data[ADXL345_SAMPLE_SIZE]; /* DATAX0 to DATAZ1 */
+};
+
+/* Time playback has reached, standby pauses it */
+static s64 adxl_replay_clock(struct adxl_replay *r)
+{
+	return r->standby_at ?: ktime_get_ns();
+}
+
+/* Queued samples that are due by now, bounded by what a real FIFO holds */
+static u32 adxl_replay_due(struct adxl_replay *r)
+{
+	u32 n = 0, queued = r->head - r->tail;
+	s64 elapsed;
+
+	if (!(r->regs[ADXL345_REG_POWER_CTL] & ADXL345_POWER_CTL_MEASURE))
+		return 0;
+
+	if (!r->speed)
+		return min_t(u32, queued, ADXL345_FIFO_SIZE);
+
+	elapsed = (ktime_get_ns() - r->anchor_time) * r->speed;
+	while (n < queued && n < ADXL345_FIFO_SIZE &&
+	       r->queue[(r->tail + n) & (ADXL_REPLAY_QUEUE - 1)].timestamp -
+			       r->anchor_sample <=
+		       elapsed)
+		n++;
+
+	return n;
+}
+
+/* Latch a due sample into the data registers */
+static void adxl_replay_pop(struct adxl_replay *r)
+{
+	struct adxl_sample *sample;
+	u32 due = adxl_replay_due(r);
+	int i;
+
+	if (!due)
+		return;
+
+	/* Without FIFO the data registers only hold the newest sample */
+	if ((r->regs[ADXL345_REG_FIFO_CTL] & ADXL345_FIFO_CTL_MODE) ==
+	    ADXL345_FIFO_BYPASS)
+		r->tail += due - 1;
+
+	sample = &r->queue[r->tail++ & (ADXL_REPLAY_QUEUE - 1)];
+	for (i = 0; i < 3; i++) {
+		s16 val = i == 0 ? sample->x : i == 1 ? sample->y : sample->z;
+
+		r->data[2 * i] = val & 0xFF;
+		r->data[2 * i + 1] = (u16)val >> 8;
+	}
+
+	wake_up_interruptible(&r->wq);
+}
+
+static int adxl_replay_reg_read(void *context, unsigned int reg,
+				unsigned int *val)
+{
+	struct adxl_replay *r = context;
+	u32 due;
+
+	spin_lock(&r->lock);
+
+	switch (reg) {
+	case ADXL345_REG_FIFO_STATUS:
+		*val = adxl_replay_due(r);
+		break;
+
+	case ADXL345_REG_INT_SOURCE:
+		due = adxl_replay_due(r);
+		*val = (due ? ADXL345_INT_DATA_READY : 0) |
+		       (due > (r->regs[ADXL345_REG_FIFO_CTL] &
+			       ADXL345_FIFO_CTL_SAMPLES) ?
+				ADXL345_INT_WATERMARK :
+				0);
+		break;
+
+	case ADXL345_REG_DATAX0:
+		adxl_replay_pop(r);
+		fallthrough;
+	case ADXL345_REG_DATAX0 + 1 ... ADXL345_REG_DATAZ0 + 1:
+		*val = r->data[reg - ADXL345_REG_DATAX0];
+		break;
+
+	default:
+		*val = r->regs[reg];
+	}
+
+	spin_unlock(&r->lock);
+	return 0;
+}
+
+static int adxl_replay_reg_write(void *context, unsigned int reg,
+				 unsigned int val)
+{
+	struct adxl_replay *r = context;
+
+	if (reg == ADXL345_REG_DEVID || reg == ADXL345_REG_INT_SOURCE ||
+	    reg == ADXL345_REG_FIFO_STATUS ||
+	    (reg >= ADXL345_REG_DATAX0 && reg <= ADXL345_REG_DATAZ0 + 1))
+		return -EPERM;
+
+	spin_lock(&r->lock);
+	/* Leaving standby moves the anchor past the pause, nothing piles up */
+	if (reg == ADXL345_REG_POWER_CTL) {
+		if (!(val & ADXL345_POWER_CTL_MEASURE) && !r->standby_at) {
+			r->standby_at = ktime_get_ns();
+		} else if ((val & ADXL345_POWER_CTL_MEASURE) && r->standby_at) {
+			r->anchor_time += ktime_get_ns() - r->standby_at;
+			r->standby_at = 0;
+		}
+	}
+	r->regs[reg] = val;
+	spin_unlock(&r->lock);
+	return 0;
+}
+
+static const struct regmap_config adxl_replay_regmap_config = {
+	.reg_bits = 8,
+	.val_bits = 8,
+	.max_register = ADXL345_REG_FIFO_STATUS,
+	.reg_read = adxl_replay_reg_read,
+	.reg_write = adxl_replay_reg_write,
+};
+
+static bool adxl_replay_has_room(struct adxl_replay *r)
+{
+	return READ_ONCE(r->head) - READ_ONCE(r->tail) < ADXL_REPLAY_QUEUE;
+}
+
+ssize_t adxl_replay_write(struct adxl_device *adxl, struct iov_iter *from,
+			  bool nonblock)
+{
+	struct adxl_replay *r = adxl->replay;
+	size_t max = iov_iter_count(from) / sizeof(struct adxl_sample);
+	size_t done = 0, bytes;
+	u32 head, room, n, first;
+	int ret = 0;
+
+	if (!max)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&r->write_lock))
+		return -ERESTARTSYS;
+
+	while (done < max) {
+		if (!adxl_replay_has_room(r)) {
+			if (done)
+				break;
+			if (nonblock) {
+				ret = -EAGAIN;
+				break;
+			}
+			if ((ret = wait_event_interruptible(
+				     r->wq, adxl_replay_has_room(r))))
+				break;
+			continue;
+		}
+
+		/* Only this writer fills slots past head, copy unlocked */
+		head = r->head;
+		room = ADXL_REPLAY_QUEUE - (head - READ_ONCE(r->tail));
+		n = min_t(size_t, room, max - done);
+		first = min_t(u32, n,
+			      ADXL_REPLAY_QUEUE - (head & (ADXL_REPLAY_QUEUE - 1)));
+
+		bytes = first * sizeof(struct adxl_sample);
+		if (copy_from_iter(&r->queue[head & (ADXL_REPLAY_QUEUE - 1)],
+				   bytes, from) != bytes) {
+			ret = -EFAULT;
+			break;
+		}
+		bytes = (n - first) * sizeof(struct adxl_sample);
+		if (copy_from_iter(r->queue, bytes, from) != bytes) {
+			ret = -EFAULT;
+			break;
+		}
+
+		spin_lock(&r->lock);
+		/* Playback restarts its clock whenever the queue ran dry */
+		if (r->head == r->tail) {
+			r->anchor_sample =
+				r->queue[head & (ADXL_REPLAY_QUEUE - 1)].timestamp;
+			r->anchor_time = adxl_replay_clock(r);
+		}
+		r->head = head + n;
+		spin_unlock(&r->lock);
+
+		done += n;
+	}
+
+	mutex_unlock(&r->write_lock);
+	return done ? done * sizeof(struct adxl_sample) : ret;
+}
+
+static ssize_t replay_speed_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(adxl->replay->speed));
+}
+
+void adxl_replay_set_speed(struct adxl_device *adxl, unsigned int val)
+{
+	struct adxl_replay *r = adxl->replay;
+
+	spin_lock(&r->lock);
+	/* Continue from the current position, from here on at the new speed */
+	if (r->speed)
+		r->anchor_sample += (adxl_replay_clock(r) - r->anchor_time) *
+				    r->speed;
+	else if (r->head != r->tail)
+		r->anchor_sample =
+			r->queue[r->tail & (ADXL_REPLAY_QUEUE - 1)].timestamp;
+	r->anchor_time = adxl_replay_clock(r);
+	r->speed = val;
+	spin_unlock(&r->lock);
+}
+
+static ssize_t replay_speed_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+
+	adxl_replay_set_speed(dev_get_drvdata(dev), val);
+	return count;
+}
+
+static DEVICE_ATTR_RW(replay_speed);
+
+/* Set up an emulated sensor on dev, without registering a /dev/adxlN */
+struct adxl_device *adxl_replay_create(struct device *dev)
+{
+	struct adxl_replay *r;
+	int ret;
+
+	r = devm_kzalloc(dev, sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return ERR_PTR(-ENOMEM);
+
+	r->queue = devm_kcalloc(dev, ADXL_REPLAY_QUEUE, sizeof(*r->queue),
+				GFP_KERNEL);
+	if (!r->queue)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_init(&r->write_lock);
+	spin_lock_init(&r->lock);
+	init_waitqueue_head(&r->wq);
+	r->speed = 1;
+	r->standby_at = ktime_get_ns(); /* POWER_CTL resets to standby */
+	r->regs[ADXL345_REG_DEVID] = ADXL345_DEVID;
+	r->regs[ADXL345_REG_BW_RATE] = 0x0A; /* 100Hz, the reset value */
+
+	r->adxl.dev = dev;
+	r->adxl.replay = r;
+	r->adxl.regmap =
+		devm_regmap_init(dev, NULL, r, &adxl_replay_regmap_config);
+	if (IS_ERR(r->adxl.regmap))
+		return ERR_PTR(dev_err_probe(dev, PTR_ERR(r->adxl.regmap),
+					     "Failed to initialize regmap\n"));
+	dev_set_drvdata(dev, &r->adxl);
+
+	if ((ret = adxl345_probe(&r->adxl)))
+		return ERR_PTR(
+			dev_err_probe(dev, ret, "Replay setup failed\n"));
+
+	return &r->adxl;
+}
+
+static int adxl_replay_probe(struct platform_device *pdev)
+{
+	struct adxl_device *adxl = adxl_replay_create(&pdev->dev);
+	int ret;
+
+	if (IS_ERR(adxl))
+		return PTR_ERR(adxl);
+
+	if ((ret = adxl_register(adxl)))
+		return ret;
+
+	device_create_file(adxl->device, &dev_attr_replay_speed);
+	return 0;
+}
+
+static void adxl_replay_remove(struct platform_device *pdev)
+{
+	struct adxl_device *adxl = platform_get_drvdata(pdev);
+
+	device_remove_file(adxl->device, &dev_attr_replay_speed);
+	adxl_unregister(adxl);
+}
+
+static struct platform_driver adxl_replay_driver = {
+	.probe = adxl_replay_probe,
+	.remove = adxl_replay_remove,
+	.driver = {
+		.name = "adxl-replay",
+		.pm = pm_ptr(&adxl345_pm_ops),
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+	},
+};
+
+int adxl_replay_init(void)
+{
+	struct platform_device *pdev;
+	unsigned int i;
+	int ret;
+
+	if (!replay_devices)
+		return 0;
+
+	if ((ret = platform_driver_register(&adxl_replay_driver)))
+		return ret;
+
+	for (i = 0; i < min(replay_devices, ADXL_MAX_DEVICES); i++) {
+		pdev = platform_device_register_simple("adxl-replay", i, NULL,
+						       0);
+		if (IS_ERR(pdev)) {
+			adxl_replay_exit();
+			return PTR_ERR(pdev);
+		}
+		replay_pdevs[i] = pdev;
+	}
+
+	return 0;
+}
+
+void adxl_replay_exit(void)
+{
+	unsigned int i;
+
+	if (!replay_devices)
+		return;
+
+	for (i = 0; i < ADXL_MAX_DEVICES; i++) {
+		if (replay_pdevs[i])
+			platform_device_unregister(replay_pdevs[i]);
+		replay_pdevs[i] = NULL;
+	}
+
+	platform_driver_unregister(&adxl_replay_driver);
+}
@@ -60,6 +60,39 @@ static ssize_t range_store(struct device *dev, struct device_attribute *attr,
 	return ret < 0 ? ret : count;
 }
 
+static ssize_t mode_show(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%d\n", READ_ONCE(adxl->default_mode));
+}
+
+static ssize_t mode_store(struct device *dev, struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	int val;
+
+	if (kstrtoint(buf, 10, &val) || val < ADXL_MODE_SINGLE ||
+	    val > ADXL_MODE_RAW)
+		return -EINVAL;
+
+	WRITE_ONCE(adxl->default_mode, val);
+	return count;
+}
+
+static ssize_t offset_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	int ret;
+	s8 ofs[3];
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	if ((ret = regmap_bulk_read(adxl->regmap, ADXL345_REG_OFSX, ofs,
+				    sizeof(ofs))))
+		return ret;
+	return sysfs_emit(buf, "%d %d %d\n", ofs[0], ofs[1], ofs[2]);
+}
+
 static ssize_t x_show(struct device *dev, struct device_attribute *attr,
 		      char *buf)
 {
@@ -90,10 +123,278 @@ static ssize_t z_show(struct device *dev, struct device_attribute *attr,
 	return sysfs_emit(buf, "%d\n", adxl->z);
 }
 
+static ssize_t resume_latency_us_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	s64 latency;
+
+	spin_lock(&adxl->ring_lock);
+	latency = adxl->resume_latency;
+	spin_unlock(&adxl->ring_lock);
+
+	return sysfs_emit(buf, "%lld\n", div_s64(latency, NSEC_PER_USEC));
+}
+
+static ssize_t stats_window_ms_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(adxl->stats_window_ms));
+}
+
+static ssize_t stats_window_ms_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	unsigned int val;
+	int ret;
+
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+
+	if ((ret = adxl345_set_stats_window(dev_get_drvdata(dev), val)))
+		return ret;
+	return count;
+}
+
+/* "seq count", then min, max, mean and rms of x, y and z, in LSB */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct adxl_stats stats;
+	int i, len;
+	u32 rms;
+
+	adxl345_get_stats(dev_get_drvdata(dev), &stats);
+
+	len = sysfs_emit(buf, "%u %u", stats.seq, stats.count);
+	for (i = 0; i < 3; i++) {
+		rms = stats.count ?
+			      int_sqrt64(div_u64(stats.sumsq[i], stats.count)) :
+			      0;
+		len += sysfs_emit_at(buf, len, " %d %d %d %u", stats.min[i],
+				     stats.max[i],
+				     DIV_ROUND_CLOSEST(stats.mean[i], 256), rms);
+	}
+	len += sysfs_emit_at(buf, len, "\n");
+	return len;
+}
+
+static ssize_t probe_time_us_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%lld\n",
+			  div_s64(adxl->probe_time, NSEC_PER_USEC));
+}
+
+static ssize_t odr_mhz_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	u32 mhz;
+	s32 ppm;
+
+	adxl345_get_odr(adxl, &mhz, &ppm);
+	return sysfs_emit(buf, "%u\n", mhz);
+}
+
+static ssize_t odr_ppm_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	u32 mhz;
+	s32 ppm;
+
+	adxl345_get_odr(adxl, &mhz, &ppm);
+	return sysfs_emit(buf, "%d\n", ppm);
+}
+
+static ssize_t worker_cpu_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%d\n", READ_ONCE(adxl->worker_cpu));
+}
+
+static ssize_t worker_cpu_store(struct device *dev,
+				struct device_attribute *attr, const char *buf,
+				size_t count)
+{
+	int val, ret;
+
+	if (kstrtoint(buf, 10, &val))
+		return -EINVAL;
+
+	if ((ret = adxl345_set_worker_cpu(dev_get_drvdata(dev), val)))
+		return ret;
+	return count;
+}
+
+/* "fifo", "fifo_low" or a nice value */
+static ssize_t worker_priority_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	int policy, prio;
+
+	mutex_lock(&adxl->lock);
+	policy = adxl->worker_policy;
+	prio = adxl->worker_prio;
+	mutex_unlock(&adxl->lock);
+
+	if (policy == SCHED_FIFO)
+		return sysfs_emit(buf, "%s\n",
+				  prio == ADXL345_WORKER_FIFO ? "fifo" :
+								"fifo_low");
+	return sysfs_emit(buf, "%d\n", prio);
+}
+
+static ssize_t worker_priority_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	int policy = SCHED_FIFO, prio, ret;
+
+	if (sysfs_streq(buf, "fifo"))
+		prio = ADXL345_WORKER_FIFO;
+	else if (sysfs_streq(buf, "fifo_low"))
+		prio = ADXL345_WORKER_FIFO_LOW;
+	else if (!kstrtoint(buf, 10, &prio))
+		policy = SCHED_NORMAL;
+	else
+		return -EINVAL;
+
+	if ((ret = adxl345_set_worker_priority(dev_get_drvdata(dev), policy,
+					       prio)))
+		return ret;
+	return count;
+}
+
+static ssize_t worker_utilization_show(struct device *dev,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	return sysfs_emit(buf, "%u\n",
+			  adxl345_worker_utilization(dev_get_drvdata(dev)));
+}
+
+static ssize_t worker_busy_us_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%lld\n",
+			  div_s64(atomic64_read(&adxl->busy_ns),
+				  NSEC_PER_USEC));
+}
+
+static ssize_t events_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(adxl->events));
+}
+
+static ssize_t events_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	unsigned int val;
+	int ret;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	if ((ret = adxl345_set_events(dev_get_drvdata(dev), val)))
+		return ret;
+	return count;
+}
+
+/* Event function settings, raw register codes in the order listed */
+static const u8 adxl_tap_regs[] = { ADXL345_REG_THRESH_TAP, ADXL345_REG_DUR,
+				    ADXL345_REG_LATENT, ADXL345_REG_WINDOW };
+static const u8 adxl_activity_regs[] = { ADXL345_REG_THRESH_ACT };
+static const u8 adxl_inactivity_regs[] = { ADXL345_REG_THRESH_INACT,
+					   ADXL345_REG_TIME_INACT };
+static const u8 adxl_free_fall_regs[] = { ADXL345_REG_THRESH_FF,
+					  ADXL345_REG_TIME_FF };
+
+static ssize_t adxl_regs_show(struct device *dev, const u8 *regs, int n,
+			      char *buf)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	unsigned int val;
+	int i, ret, len = 0;
+
+	for (i = 0; i < n; i++) {
+		if ((ret = regmap_read(adxl->regmap, regs[i], &val)))
+			return ret;
+		len += sysfs_emit_at(buf, len, i ? " %u" : "%u", val);
+	}
+	len += sysfs_emit_at(buf, len, "\n");
+	return len;
+}
+
+static ssize_t adxl_regs_store(struct device *dev, const u8 *regs, int n,
+			       const char *buf, size_t count)
+{
+	struct adxl_device *adxl = dev_get_drvdata(dev);
+	unsigned int val[4];
+	int i, ret;
+
+	if (sscanf(buf, "%u %u %u %u", &val[0], &val[1], &val[2], &val[3]) !=
+	    n)
+		return -EINVAL;
+
+	for (i = 0; i < n; i++)
+		if (val[i] > U8_MAX)
+			return -EINVAL;
+
+	for (i = 0; i < n; i++)
+		if ((ret = regmap_write(adxl->regmap, regs[i], val[i])))
+			return ret;
+	return count;
+}
+
+#define ADXL_EVENT_REGS_ATTR(name)                                       \
+	static ssize_t name##_show(struct device *dev,                       \
+				   struct device_attribute *attr, char *buf) \
+	{                                                                    \
+		return adxl_regs_show(dev, adxl_##name##_regs,               \
+				      ARRAY_SIZE(adxl_##name##_regs), buf);  \
+	}                                                                    \
+	static ssize_t name##_store(struct device *dev,                      \
+				    struct device_attribute *attr,           \
+				    const char *buf, size_t count)           \
+	{                                                                    \
+		return adxl_regs_store(dev, adxl_##name##_regs,              \
+				       ARRAY_SIZE(adxl_##name##_regs), buf,  \
+				       count);                               \
+	}                                                                    \
+	static DEVICE_ATTR_RW(name)
+
+ADXL_EVENT_REGS_ATTR(tap);
+ADXL_EVENT_REGS_ATTR(activity);
+ADXL_EVENT_REGS_ATTR(inactivity);
+ADXL_EVENT_REGS_ATTR(free_fall);
+
 static DEVICE_ATTR_WO(enable);
 static DEVICE_ATTR_WO(disable);
 static DEVICE_ATTR_RW(rate);
 static DEVICE_ATTR_RW(range);
+static DEVICE_ATTR_RW(mode);
+static DEVICE_ATTR_RO(offset);
+static DEVICE_ATTR_RO(resume_latency_us);
+static DEVICE_ATTR_RW(stats_window_ms);
+static DEVICE_ATTR_RO(stats);
+static DEVICE_ATTR_RO(probe_time_us);
+static DEVICE_ATTR_RO(odr_mhz);
+static DEVICE_ATTR_RO(odr_ppm);
+static DEVICE_ATTR_RW(worker_cpu);
+static DEVICE_ATTR_RW(worker_priority);
+static DEVICE_ATTR_RO(worker_utilization);
+static DEVICE_ATTR_RO(worker_busy_us);
+static DEVICE_ATTR_RW(events);
 static DEVICE_ATTR_RO(x);
 static DEVICE_ATTR_RO(y);
 static DEVICE_ATTR_RO(z);
@@ -104,6 +405,23 @@ int adxl345_sysfs_init(struct adxl_device *adxl_device)
 	device_create_file(adxl_device->device, &dev_attr_disable);
 	device_create_file(adxl_device->device, &dev_attr_rate);
 	device_create_file(adxl_device->device, &dev_attr_range);
+	device_create_file(adxl_device->device, &dev_attr_mode);
+	device_create_file(adxl_device->device, &dev_attr_offset);
+	device_create_file(adxl_device->device, &dev_attr_resume_latency_us);
+	device_create_file(adxl_device->device, &dev_attr_stats_window_ms);
+	device_create_file(adxl_device->device, &dev_attr_stats);
+	device_create_file(adxl_device->device, &dev_attr_probe_time_us);
+	device_create_file(adxl_device->device, &dev_attr_odr_mhz);
+	device_create_file(adxl_device->device, &dev_attr_odr_ppm);
+	device_create_file(adxl_device->device, &dev_attr_worker_cpu);
+	device_create_file(adxl_device->device, &dev_attr_worker_priority);
+	device_create_file(adxl_device->device, &dev_attr_worker_utilization);
+	device_create_file(adxl_device->device, &dev_attr_worker_busy_us);
+	device_create_file(adxl_device->device, &dev_attr_events);
+	device_create_file(adxl_device->device, &dev_attr_tap);
+	device_create_file(adxl_device->device, &dev_attr_activity);
+	device_create_file(adxl_device->device, &dev_attr_inactivity);
+	device_create_file(adxl_device->device, &dev_attr_free_fall);
 	device_create_file(adxl_device->device, &dev_attr_x);
 	device_create_file(adxl_device->device, &dev_attr_y);
 	device_create_file(adxl_device->device, &dev_attr_z);
@@ -112,9 +430,26 @@ int adxl345_sysfs_init(struct adxl_device *adxl_device)
 
 int adxl345_sysfs_deinit(struct adxl_device *adxl_device)
 {
+	device_remove_file(adxl_device->device, &dev_attr_free_fall);
+	device_remove_file(adxl_device->device, &dev_attr_inactivity);
+	device_remove_file(adxl_device->device, &dev_attr_activity);
+	device_remove_file(adxl_device->device, &dev_attr_tap);
+	device_remove_file(adxl_device->device, &dev_attr_events);
 	device_remove_file(adxl_device->device, &dev_attr_z);
 	device_remove_file(adxl_device->device, &dev_attr_y);
 	device_remove_file(adxl_device->device, &dev_attr_x);
+	device_remove_file(adxl_device->device, &dev_attr_offset);
+	device_remove_file(adxl_device->device, &dev_attr_resume_latency_us);
+	device_remove_file(adxl_device->device, &dev_attr_stats_window_ms);
+	device_remove_file(adxl_device->device, &dev_attr_stats);
+	device_remove_file(adxl_device->device, &dev_attr_probe_time_us);
+	device_remove_file(adxl_device->device, &dev_attr_odr_mhz);
+	device_remove_file(adxl_device->device, &dev_attr_odr_ppm);
+	device_remove_file(adxl_device->device, &dev_attr_worker_cpu);
+	device_remove_file(adxl_device->device, &dev_attr_worker_priority);
+	device_remove_file(adxl_device->device, &dev_attr_worker_utilization);
+	device_remove_file(adxl_device->device, &dev_attr_worker_busy_us);
+	device_remove_file(adxl_device->device, &dev_attr_mode);
 	device_remove_file(adxl_device->device, &dev_attr_range);
 	device_remove_file(adxl_device->device, &dev_attr_rate);
 	device_remove_file(adxl_device->device, &dev_attr_disable);
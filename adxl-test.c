@@ -0,0 +1,826 @@
+#include <kunit/device.h>
+#include <kunit/test.h>
+#include <linux/mman.h>
+#include <linux/uio.h>
+
+#include "adxl.h"
+
+/*
+ * KUnit suite for the core and fops paths, without a sensor: every case
+ * runs on a fresh replay device, whose emulated register file stands in
+ * for SPI. It is built into adxl.ko with CONFIG_ADXL_KUNIT_TEST=y (see the
+ * Makefile) and runs when the module loads on a kernel with KUnit, e.g. a
+ * UML or QEMU x86 one. The timing cases fail once a hot path gets slower
+ * than its budget, which leaves room for slow emulators.
+ */
+
+extern struct file_operations adxl_fops;
+
+#define ADXL_TEST_ROUNDS 1000
+#define ADXL_TEST_TIMEOUT_NS (5 * NSEC_PER_SEC)
+#define ADXL_TEST_READERS 2
+#define ADXL_TEST_STATS_SAMPLES 8
+#define ADXL_TEST_DRIFT_SAMPLES 4000 /* 10 s at 400 Hz, fits the queue */
+#define ADXL_TEST_DRIFT_MS 9000 /* Three 2.6 s drift intervals and a margin */
+
+/* Hot path budgets, per call or per formatted line */
+#define ADXL_TEST_UPDATE_AXIS_NS 50000
+#define ADXL_TEST_FORMAT_NS 5000
+#define ADXL_TEST_IOCTL_NS 5000
+
+struct adxl_test {
+	struct adxl_device *adxl;
+	struct inode inode; /* Only i_cdev, as adxl_open() needs it */
+};
+
+struct adxl_test_reader {
+	struct file *file;
+	struct completion done;
+	u32 want, count; /* Each sample read should carry seq == count */
+	bool ordered;
+};
+
+static void adxl_test_release(void *file)
+{
+	adxl_fops.release(((struct file *)file)->f_inode, file);
+}
+
+/* An fd of the test device, closed when the case ends */
+static struct file *adxl_test_open(struct kunit *test, int mode)
+{
+	struct adxl_test *t = test->priv;
+	struct file *file;
+
+	file = kunit_kzalloc(test, sizeof(*file), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, file);
+
+	file->f_inode = &t->inode;
+	WRITE_ONCE(t->adxl->default_mode, mode);
+	KUNIT_ASSERT_EQ(test, adxl_fops.open(&t->inode, file), 0);
+	KUNIT_ASSERT_EQ(test,
+			kunit_add_action_or_reset(test, adxl_test_release,
+						  file),
+			0);
+	return file;
+}
+
+static ssize_t adxl_test_read_at(struct file *file, void *buf, size_t len,
+				 bool nowait, loff_t *pos)
+{
+	struct kvec kvec = { .iov_base = buf, .iov_len = len };
+	struct iov_iter to;
+	struct kiocb kiocb;
+	ssize_t ret;
+
+	init_sync_kiocb(&kiocb, file);
+	kiocb.ki_pos = *pos;
+	if (nowait)
+		kiocb.ki_flags |= IOCB_NOWAIT;
+	iov_iter_kvec(&to, ITER_DEST, &kvec, 1, len);
+	ret = adxl_fops.read_iter(&kiocb, &to);
+	*pos = kiocb.ki_pos;
+	return ret;
+}
+
+static ssize_t adxl_test_read(struct file *file, void *buf, size_t len,
+			      bool nowait)
+{
+	loff_t pos = 0;
+
+	return adxl_test_read_at(file, buf, len, nowait, &pos);
+}
+
+/* Queue samples on the emulated FIFO, as adxlrec -R would */
+static ssize_t adxl_test_write(struct file *file,
+			       const struct adxl_sample *samples, size_t n)
+{
+	struct kvec kvec = { .iov_base = (void *)samples,
+			     .iov_len = n * sizeof(*samples) };
+	struct iov_iter from;
+	struct kiocb kiocb;
+
+	init_sync_kiocb(&kiocb, file);
+	iov_iter_kvec(&from, ITER_SOURCE, &kvec, 1, kvec.iov_len);
+	return adxl_fops.write_iter(&kiocb, &from);
+}
+
+/* Drain until the FIFO is empty, racing the poll worker is fine */
+static int adxl_test_drain(struct adxl_device *adxl)
+{
+	int ret;
+
+	while ((ret = adxl345_drain_fifo(adxl)) > 0)
+		;
+	return ret;
+}
+
+static void adxl_test_play(struct kunit *test, struct file *file,
+			   const struct adxl_sample *samples, size_t n)
+{
+	struct adxl_test *t = test->priv;
+
+	KUNIT_ASSERT_EQ(test, adxl_test_write(file, samples, n),
+			(ssize_t)(n * sizeof(*samples)));
+	KUNIT_ASSERT_EQ(test, adxl_test_drain(t->adxl), 0);
+}
+
+static struct adxl_sample *adxl_test_samples(struct kunit *test, size_t n)
+{
+	struct adxl_sample *samples;
+	size_t i;
+
+	samples = kunit_kcalloc(test, n, sizeof(*samples), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, samples);
+
+	for (i = 0; i < n; i++) {
+		samples[i].timestamp = i * NSEC_PER_MSEC;
+		samples[i].x = i;
+		samples[i].y = -(s16)i;
+		samples[i].z = 256 + i;
+	}
+	return samples;
+}
+
+static void adxl_test_decode(struct kunit *test)
+{
+	static const s16 values[][3] = {
+		{ 0, -1, 1 },
+		{ 4095, -4096, 256 },
+		{ 32767, -32768, 0 },
+		{ 0x0102, 0x7f80, -0x0102 },
+	};
+	struct adxl_sample *samples, out[ARRAY_SIZE(values)];
+	struct adxl_test *t = test->priv;
+	struct file *file;
+	int i;
+
+	file = adxl_test_open(test, ADXL_MODE_BINARY);
+	samples = adxl_test_samples(test, ARRAY_SIZE(values));
+	for (i = 0; i < ARRAY_SIZE(values); i++) {
+		samples[i].x = values[i][0];
+		samples[i].y = values[i][1];
+		samples[i].z = values[i][2];
+	}
+
+	adxl_test_play(test, file, samples, ARRAY_SIZE(values));
+
+	KUNIT_ASSERT_EQ(test, adxl_test_read(file, out, sizeof(out), true),
+			(ssize_t)sizeof(out));
+	for (i = 0; i < ARRAY_SIZE(values); i++) {
+		KUNIT_EXPECT_EQ(test, out[i].seq, i);
+		KUNIT_EXPECT_EQ(test, out[i].x, values[i][0]);
+		KUNIT_EXPECT_EQ(test, out[i].y, values[i][1]);
+		KUNIT_EXPECT_EQ(test, out[i].z, values[i][2]);
+	}
+
+	/* The newest drained sample also backs the x, y and z attributes */
+	KUNIT_EXPECT_EQ(test, t->adxl->x, values[3][0]);
+	KUNIT_EXPECT_EQ(test, t->adxl->z, values[3][2]);
+}
+
+static void adxl_test_single(struct kunit *test)
+{
+	struct adxl_sample sample = { .x = 12, .y = -34, .z = 567 };
+	struct file *file = adxl_test_open(test, ADXL_MODE_SINGLE);
+	char buf[32];
+	loff_t pos = 0;
+	ssize_t len;
+
+	KUNIT_ASSERT_EQ(test, adxl_test_write(file, &sample, 1),
+			(ssize_t)sizeof(sample));
+
+	/* A short read continues the same line, then EOF */
+	len = adxl_test_read_at(file, buf, 3, false, &pos);
+	KUNIT_ASSERT_EQ(test, len, 3);
+	len = adxl_test_read_at(file, buf + 3, sizeof(buf) - 4, false, &pos);
+	KUNIT_ASSERT_GT(test, len, 0);
+	buf[3 + len] = '\0';
+	KUNIT_EXPECT_STREQ(test, buf, "12,-34,567\n");
+	KUNIT_EXPECT_EQ(test, pos, (loff_t)strlen(buf));
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_read_at(file, buf, sizeof(buf), false, &pos),
+			0);
+}
+
+static void adxl_test_stream_format(struct kunit *test)
+{
+	struct file *file = adxl_test_open(test, ADXL_MODE_STREAM);
+	struct adxl_sample *samples = adxl_test_samples(test, 3);
+	s64 timestamp, prev = 0;
+	char buf[256], *line, *p;
+	int x, y, z, i = 0;
+	ssize_t len;
+	u32 seq;
+
+	adxl_test_play(test, file, samples, 3);
+
+	len = adxl_test_read(file, buf, sizeof(buf) - 1, true);
+	KUNIT_ASSERT_GT(test, len, 0);
+	buf[len] = '\0';
+
+	for (p = buf; (line = strsep(&p, "\n")) && *line; i++) {
+		KUNIT_ASSERT_EQ(test,
+				sscanf(line, "%lld,%u,%d,%d,%d", &timestamp,
+				       &seq, &x, &y, &z),
+				5);
+		KUNIT_EXPECT_EQ(test, seq, i);
+		KUNIT_EXPECT_EQ(test, x, samples[i].x);
+		KUNIT_EXPECT_EQ(test, y, samples[i].y);
+		KUNIT_EXPECT_EQ(test, z, samples[i].z);
+		/* One drain, so exactly a nominal 100Hz period apart */
+		if (i)
+			KUNIT_EXPECT_EQ(test, timestamp - prev,
+					(s64)ADXL345_RATE_PERIOD_NS(0x0A));
+		prev = timestamp;
+	}
+	KUNIT_EXPECT_EQ(test, i, 3);
+
+	KUNIT_EXPECT_EQ(test, adxl_test_read(file, buf, sizeof(buf), true),
+			-EAGAIN);
+}
+
+static void adxl_test_rate_range(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	unsigned int val;
+	u32 mhz;
+	s32 ppm;
+
+	KUNIT_EXPECT_EQ(test, ADXL345_RATE_PERIOD_NS(0x0F), 312500ULL);
+	KUNIT_EXPECT_EQ(test, ADXL345_RATE_PERIOD_NS(0x0A), 10000000ULL);
+	KUNIT_EXPECT_EQ(test, ADXL345_RATE_PERIOD_NS(0x00), 10240000000ULL);
+
+	KUNIT_EXPECT_EQ(test, adxl345_write_rate(adxl, 0x0F), 0x0F);
+	KUNIT_ASSERT_EQ(test, regmap_read(adxl->regmap, ADXL345_REG_BW_RATE,
+					  &val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, 0x0F);
+
+	/* Only the rate bits of BW_RATE are taken */
+	KUNIT_EXPECT_EQ(test, adxl345_write_rate(adxl, 0x1A), 0x0A);
+	KUNIT_ASSERT_EQ(test, adxl345_read_rate(adxl), 0);
+	KUNIT_EXPECT_EQ(test, adxl->sample_rate, 0x0A);
+
+	adxl345_get_odr(adxl, &mhz, &ppm);
+	KUNIT_EXPECT_EQ(test, mhz, 100000);
+	KUNIT_EXPECT_EQ(test, ppm, 0);
+
+	/* Range changes keep full resolution, raw decoding relies on it */
+	KUNIT_EXPECT_EQ(test, adxl345_write_range(adxl, 0x07),
+			ADXL345_DATA_FORMAT_16G);
+	KUNIT_EXPECT_EQ(test, adxl->data_format,
+			ADXL345_DATA_FORMAT_FULL_RES | ADXL345_DATA_FORMAT_16G);
+	KUNIT_ASSERT_EQ(test, adxl345_read_range(adxl), 0);
+	KUNIT_EXPECT_EQ(test, adxl->measurement_range,
+			ADXL345_DATA_FORMAT_16G);
+}
+
+static void adxl_test_raw(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	struct file *file = adxl_test_open(test, ADXL_MODE_RAW);
+	struct adxl_sample *samples = adxl_test_samples(test, 40), *out;
+	size_t size = 4 * ADXL_RAW_BURST_MAX, off = 0;
+	struct adxl_raw_burst hdr;
+	u32 total = 0, i;
+	ssize_t len;
+	u8 *buf, *p;
+
+	buf = kunit_kzalloc(test, size, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	adxl_test_play(test, file, samples, 40);
+
+	len = adxl_test_read(file, buf, size, true);
+	KUNIT_ASSERT_GT(test, len, 0);
+
+	while (off + sizeof(hdr) <= len) {
+		memcpy(&hdr, buf + off, sizeof(hdr));
+		KUNIT_EXPECT_EQ(test, hdr.seq, total);
+		KUNIT_EXPECT_EQ(test, hdr.data_format,
+				ADXL345_DATA_FORMAT_FULL_RES);
+		KUNIT_EXPECT_EQ(test, hdr.flags, 0);
+		KUNIT_ASSERT_LE(test, hdr.count, ADXL_RAW_MAX_COUNT);
+
+		for (i = 0; i < hdr.count; i++, total++) {
+			p = buf + off + sizeof(hdr) + i * ADXL_RAW_SAMPLE_SIZE;
+			KUNIT_EXPECT_EQ(test, (s16)(p[0] | p[1] << 8),
+					samples[total].x);
+			KUNIT_EXPECT_EQ(test, (s16)(p[2] | p[3] << 8),
+					samples[total].y);
+			KUNIT_EXPECT_EQ(test, (s16)(p[4] | p[5] << 8),
+					samples[total].z);
+		}
+		off += sizeof(hdr) + hdr.count * ADXL_RAW_SAMPLE_SIZE;
+	}
+
+	KUNIT_EXPECT_EQ(test, off, len);
+	KUNIT_EXPECT_EQ(test, total, 40);
+	/* Raw streams alone leave the sample ring untouched */
+	KUNIT_EXPECT_EQ(test, adxl->head, 0);
+
+	/* Decoded samples number on from the raw bursts */
+	file = adxl_test_open(test, ADXL_MODE_BINARY);
+	adxl_test_play(test, file, samples, 8);
+	KUNIT_ASSERT_EQ(test, adxl_test_read(file, buf, 8 * sizeof(*out), true),
+			(ssize_t)(8 * sizeof(*out)));
+	out = (struct adxl_sample *)buf;
+	for (i = 0; i < 8; i++)
+		KUNIT_EXPECT_EQ(test, out[i].seq, 40 + i);
+}
+
+static void adxl_test_overrun(struct kunit *test)
+{
+	struct file *file = adxl_test_open(test, ADXL_MODE_BINARY);
+	size_t n = ADXL_RING_SIZE + 100, total = 0;
+	struct adxl_sample *samples, *out;
+	ssize_t len;
+
+	samples = adxl_test_samples(test, n);
+	out = kunit_kcalloc(test, ADXL_RING_SIZE, sizeof(*out), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, out);
+
+	adxl_test_play(test, file, samples, n);
+
+	/* A reader that fell behind resumes at the oldest sample kept */
+	while (total < ADXL_RING_SIZE &&
+	       (len = adxl_test_read(file, out + total,
+				     (ADXL_RING_SIZE - total) * sizeof(*out),
+				     true)) > 0)
+		total += len / sizeof(*out);
+
+	KUNIT_ASSERT_EQ(test, total, ADXL_RING_SIZE);
+	KUNIT_EXPECT_EQ(test, adxl_test_read(file, out, sizeof(*out), true),
+			-EAGAIN);
+	KUNIT_EXPECT_EQ(test, out[0].seq, 100);
+	KUNIT_EXPECT_EQ(test, out[0].x, samples[100].x);
+	KUNIT_EXPECT_EQ(test, out[total - 1].seq, n - 1);
+}
+
+static int adxl_test_reader(void *data)
+{
+	struct adxl_test_reader *r = data;
+	s64 deadline = ktime_get_ns() + ADXL_TEST_TIMEOUT_NS;
+	struct adxl_sample buf[16];
+	ssize_t len;
+	int i;
+
+	while (r->count < r->want && ktime_get_ns() < deadline) {
+		len = adxl_test_read(r->file, buf, sizeof(buf), true);
+		if (len == -EAGAIN) {
+			usleep_range(50, 100);
+			continue;
+		}
+		if (len < 0)
+			break;
+		for (i = 0; i < len / sizeof(*buf); i++)
+			r->ordered &= buf[i].seq == r->count++;
+	}
+
+	complete(&r->done);
+	return 0;
+}
+
+/* Readers on their own fds each see every sample, while drains go on */
+static void adxl_test_readers(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	struct adxl_test_reader readers[ADXL_TEST_READERS];
+	size_t n = ADXL_RING_SIZE / 2, i, chunk;
+	struct adxl_sample *samples;
+	struct task_struct *task;
+	bool played = true;
+
+	samples = adxl_test_samples(test, n);
+	for (i = 0; i < ADXL_TEST_READERS; i++) {
+		readers[i] = (struct adxl_test_reader){
+			.file = adxl_test_open(test, ADXL_MODE_BINARY),
+			.want = n,
+			.ordered = true,
+		};
+		init_completion(&readers[i].done);
+	}
+
+	/* Readers use the stack, so nothing may return before they finish */
+	for (i = 0; i < ADXL_TEST_READERS; i++) {
+		task = kthread_run(adxl_test_reader, &readers[i],
+				   "adxl-test/%zu", i);
+		if (IS_ERR(task)) {
+			KUNIT_FAIL(test, "Failed to start reader %zu", i);
+			complete(&readers[i].done);
+		}
+	}
+
+	for (i = 0; i < n && played; i += chunk) {
+		chunk = min_t(size_t, n - i, ADXL345_FIFO_SIZE);
+		played = adxl_test_write(readers[0].file, samples + i,
+					 chunk) == chunk * sizeof(*samples) &&
+			 !adxl_test_drain(adxl);
+	}
+
+	for (i = 0; i < ADXL_TEST_READERS; i++)
+		wait_for_completion(&readers[i].done);
+
+	KUNIT_EXPECT_TRUE(test, played);
+	for (i = 0; i < ADXL_TEST_READERS; i++) {
+		KUNIT_EXPECT_EQ(test, readers[i].count, n);
+		KUNIT_EXPECT_TRUE(test, readers[i].ordered);
+	}
+}
+
+static void adxl_test_nowait(struct kunit *test)
+{
+	struct file *stream = adxl_test_open(test, ADXL_MODE_STREAM);
+	struct file *binary = adxl_test_open(test, ADXL_MODE_BINARY);
+	struct file *raw = adxl_test_open(test, ADXL_MODE_RAW);
+	struct file *single = adxl_test_open(test, ADXL_MODE_SINGLE);
+	char buf[64];
+
+	/* Single reads go to the bus, io_uring has to retry them blocking */
+	KUNIT_EXPECT_EQ(test, adxl_test_read(single, buf, sizeof(buf), true),
+			-EAGAIN);
+	KUNIT_EXPECT_GT(test, adxl_test_read(single, buf, sizeof(buf), false),
+			0);
+
+	KUNIT_EXPECT_EQ(test, adxl_test_read(stream, buf, sizeof(buf), true),
+			-EAGAIN);
+	KUNIT_EXPECT_EQ(test, adxl_test_read(binary, buf, sizeof(buf), true),
+			-EAGAIN);
+	KUNIT_EXPECT_EQ(test, adxl_test_read(raw, buf, sizeof(buf), true),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_read(binary, buf,
+				       sizeof(struct adxl_sample) - 1, true),
+			-EINVAL);
+}
+
+/* ioctl() on an int in user memory, *val in and out */
+static long adxl_test_ioctl(struct kunit *test, struct file *file,
+			    unsigned int cmd, int __user *uval, int *val)
+{
+	long ret;
+
+	KUNIT_ASSERT_EQ(test, copy_to_user(uval, val, sizeof(*val)), 0);
+	ret = adxl_fops.unlocked_ioctl(file, cmd, (unsigned long)uval);
+	KUNIT_ASSERT_EQ(test, copy_from_user(val, uval, sizeof(*val)), 0);
+	return ret;
+}
+
+static void adxl_test_ioctls(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	struct file *file = adxl_test_open(test, ADXL_MODE_BINARY);
+	unsigned long uaddr;
+	int __user *uval;
+	int val = 0, i;
+	s64 start;
+
+	uaddr = kunit_vm_mmap(test, NULL, 0, PAGE_SIZE, PROT_READ | PROT_WRITE,
+			      MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_NE_MSG(test, uaddr, 0, "No user memory for ioctls");
+	uval = (int __user *)uaddr;
+
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_ioctl(test, file, ADXL_IOCTL_GET_MODE, uval,
+					&val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, ADXL_MODE_BINARY);
+
+	/* Streaming to streaming keeps the one stream the fd holds */
+	val = ADXL_MODE_STREAM;
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_ioctl(test, file, ADXL_IOCTL_SET_MODE, uval,
+					&val),
+			0);
+	KUNIT_EXPECT_EQ(test, adxl->stream_users, 1);
+	val = ADXL_MODE_RAW + 1;
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_ioctl(test, file, ADXL_IOCTL_SET_MODE, uval,
+					&val),
+			-EINVAL);
+
+	val = 0x0F;
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_ioctl(test, file, ADXL_IOCTL_SET_RATE, uval,
+					&val),
+			0);
+	val = 0;
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_ioctl(test, file, ADXL_IOCTL_GET_RATE, uval,
+					&val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, 0x0F);
+
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_ioctl(test, file,
+					_IO(ADXL_MAGIC, ADXL_MAXNR + 1), uval,
+					&val),
+			-ENOTTY);
+
+	start = ktime_get_ns();
+	for (i = 0; i < ADXL_TEST_ROUNDS; i++)
+		adxl_fops.unlocked_ioctl(file, ADXL_IOCTL_GET_MODE, uaddr);
+	start = div_s64(ktime_get_ns() - start, ADXL_TEST_ROUNDS);
+
+	kunit_info(test, "ioctl dispatch %lld ns\n", start);
+	KUNIT_EXPECT_LT(test, start, ADXL_TEST_IOCTL_NS);
+}
+
+struct adxl_test_blocked {
+	struct file *file;
+	struct completion done;
+	char buf[ADXL_LINE_MAX];
+	ssize_t len;
+};
+
+static int adxl_test_blocked_read(void *data)
+{
+	struct adxl_test_blocked *b = data;
+
+	b->len = adxl_test_read(b->file, b->buf, sizeof(b->buf), false);
+	complete(&b->done);
+	return 0;
+}
+
+/* A reader asleep on an idle device must not hold up mode changes */
+static void adxl_test_mode_wakes_reader(struct kunit *test)
+{
+	struct adxl_test_blocked b = {
+		.file = adxl_test_open(test, ADXL_MODE_BINARY),
+	};
+	struct task_struct *task;
+	unsigned long uaddr;
+	int val;
+
+	uaddr = kunit_vm_mmap(test, NULL, 0, PAGE_SIZE, PROT_READ | PROT_WRITE,
+			      MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_NE_MSG(test, uaddr, 0, "No user memory for ioctls");
+
+	init_completion(&b.done);
+	task = kthread_run(adxl_test_blocked_read, &b, "adxl-test/blocked");
+	KUNIT_ASSERT_FALSE(test, IS_ERR(task));
+	msleep(20);
+
+	val = ADXL_MODE_SINGLE;
+	KUNIT_EXPECT_EQ(test,
+			adxl_test_ioctl(test, b.file, ADXL_IOCTL_SET_MODE,
+					(int __user *)uaddr, &val),
+			0);
+
+	/* The reader restarts in single mode and returns a line */
+	if (!wait_for_completion_timeout(&b.done, HZ)) {
+		KUNIT_FAIL(test, "Reader still asleep after the mode change");
+		wait_for_completion(&b.done);
+	}
+	KUNIT_EXPECT_GT(test, b.len, 0);
+}
+
+static void adxl_test_hot_paths(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	struct adxl_sample *samples;
+	s64 start, elapsed = 0;
+	struct file *file;
+	ssize_t len;
+	char *buf;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < ADXL_TEST_ROUNDS; i++)
+		KUNIT_ASSERT_EQ(test, adxl345_update_axis(adxl), 0);
+	start = div_s64(ktime_get_ns() - start, ADXL_TEST_ROUNDS);
+
+	kunit_info(test, "adxl345_update_axis %lld ns\n", start);
+	KUNIT_EXPECT_LT(test, start, ADXL_TEST_UPDATE_AXIS_NS);
+
+	/* Full batches, one read formats and copies each */
+	file = adxl_test_open(test, ADXL_MODE_STREAM);
+	samples = adxl_test_samples(test, ADXL_READ_BATCH);
+	buf = kunit_kzalloc(test, ADXL_BUF_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	for (i = 0; i < ADXL_TEST_ROUNDS / 100; i++) {
+		adxl_test_play(test, file, samples, ADXL_READ_BATCH);
+		start = ktime_get_ns();
+		len = adxl_test_read(file, buf, ADXL_BUF_SIZE, true);
+		elapsed += ktime_get_ns() - start;
+		KUNIT_ASSERT_GT(test, len, 0);
+	}
+	elapsed = div_s64(elapsed, ADXL_TEST_ROUNDS / 100 * ADXL_READ_BATCH);
+
+	kunit_info(test, "stream formatting %lld ns per line\n", elapsed);
+	KUNIT_EXPECT_LT(test, elapsed, ADXL_TEST_FORMAT_NS);
+}
+
+/* Suspend keeps the configuration, resume writes it back */
+static void adxl_test_runtime_pm(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	unsigned int val;
+
+	KUNIT_ASSERT_EQ(test, adxl345_write_rate(adxl, 0x0C), 0x0C);
+	KUNIT_ASSERT_EQ(test, adxl345_pm_ops.runtime_suspend(adxl->dev), 0);
+
+	KUNIT_ASSERT_EQ(test, regmap_read(adxl->regmap, ADXL345_REG_POWER_CTL,
+					  &val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, ADXL345_POWER_CTL_STANDBY);
+	KUNIT_ASSERT_EQ(test,
+			regmap_write(adxl->regmap, ADXL345_REG_BW_RATE, 0), 0);
+
+	KUNIT_ASSERT_EQ(test, adxl345_pm_ops.runtime_resume(adxl->dev), 0);
+	KUNIT_ASSERT_EQ(test, regmap_read(adxl->regmap, ADXL345_REG_BW_RATE,
+					  &val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, 0x0C);
+	KUNIT_ASSERT_EQ(test, regmap_read(adxl->regmap, ADXL345_REG_POWER_CTL,
+					  &val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, ADXL345_POWER_CTL_MEASURE);
+}
+
+static void adxl_test_events(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	unsigned int val;
+
+	KUNIT_EXPECT_EQ(test, adxl345_set_events(adxl, ADXL_EVENT_OVERRUN),
+			-EINVAL);
+	KUNIT_ASSERT_EQ(test, regmap_read(adxl->regmap, ADXL345_REG_INT_MAP,
+					  &val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, ADXL345_INT_EVENTS);
+
+	/* Enabled events stream without any open file */
+	KUNIT_ASSERT_EQ(test,
+			adxl345_set_events(adxl, ADXL_EVENT_FREE_FALL |
+							 ADXL_EVENT_SINGLE_TAP),
+			0);
+	KUNIT_EXPECT_EQ(test, adxl->stream_users, 1);
+	KUNIT_ASSERT_EQ(test, regmap_read(adxl->regmap,
+					  ADXL345_REG_INT_ENABLE, &val),
+			0);
+	KUNIT_EXPECT_EQ(test, val,
+			ADXL345_INT_FREE_FALL | ADXL345_INT_SINGLE_TAP);
+
+	KUNIT_ASSERT_EQ(test, adxl345_set_events(adxl, ADXL_EVENT_ACTIVITY), 0);
+	KUNIT_EXPECT_EQ(test, adxl->stream_users, 1);
+
+	KUNIT_ASSERT_EQ(test, adxl345_set_events(adxl, 0), 0);
+	KUNIT_EXPECT_EQ(test, adxl->stream_users, 0);
+	KUNIT_ASSERT_EQ(test, regmap_read(adxl->regmap,
+					  ADXL345_REG_INT_ENABLE, &val),
+			0);
+	KUNIT_EXPECT_EQ(test, val, 0);
+}
+
+/* A window closes with the first sample past it and holds what came before */
+static void adxl_test_stats(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	struct file *file = adxl_test_open(test, ADXL_MODE_SINGLE);
+	struct adxl_sample *samples;
+	struct adxl_stats stats;
+
+	samples = adxl_test_samples(test, ADXL_TEST_STATS_SAMPLES + 1);
+	KUNIT_ASSERT_EQ(test, adxl345_write_rate(adxl, 0x0F), 0x0F);
+	KUNIT_ASSERT_EQ(test, adxl345_set_stats_window(adxl, 10), 0);
+	KUNIT_EXPECT_EQ(test, adxl->stream_users, 1);
+
+	/* 3200 Hz spaces the samples of one drain well within the window */
+	KUNIT_ASSERT_EQ(test,
+			adxl_test_write(file, samples, ADXL_TEST_STATS_SAMPLES),
+			(ssize_t)(ADXL_TEST_STATS_SAMPLES * sizeof(*samples)));
+	KUNIT_ASSERT_EQ(test, adxl_test_drain(adxl), 0);
+	adxl345_get_stats(adxl, &stats);
+	KUNIT_EXPECT_EQ(test, stats.count, 0);
+
+	msleep(20);
+	KUNIT_ASSERT_EQ(test,
+			adxl_test_write(file, samples + ADXL_TEST_STATS_SAMPLES,
+					1),
+			(ssize_t)sizeof(*samples));
+	KUNIT_ASSERT_EQ(test, adxl_test_drain(adxl), 0);
+
+	/* x = i, y = -i and z = 256 + i for i below 8 */
+	adxl345_get_stats(adxl, &stats);
+	KUNIT_EXPECT_EQ(test, stats.seq, 0);
+	KUNIT_EXPECT_EQ(test, stats.count, ADXL_TEST_STATS_SAMPLES);
+	KUNIT_EXPECT_LE(test, stats.end - stats.start,
+			10 * (s64)NSEC_PER_MSEC);
+	KUNIT_EXPECT_EQ(test, stats.min[0], 0);
+	KUNIT_EXPECT_EQ(test, stats.max[0], 7);
+	KUNIT_EXPECT_EQ(test, stats.min[1], -7);
+	KUNIT_EXPECT_EQ(test, stats.max[1], 0);
+	KUNIT_EXPECT_EQ(test, stats.min[2], 256);
+	KUNIT_EXPECT_EQ(test, stats.max[2], 263);
+	KUNIT_EXPECT_EQ(test, stats.mean[0], 896);
+	KUNIT_EXPECT_EQ(test, stats.mean[1], -896);
+	KUNIT_EXPECT_EQ(test, stats.mean[2], 66432);
+	KUNIT_EXPECT_EQ(test, stats.sum[2], 2076);
+	KUNIT_EXPECT_EQ(test, stats.sumsq[0], 140);
+	KUNIT_EXPECT_EQ(test, stats.sumsq[1], 140);
+	KUNIT_EXPECT_EQ(test, stats.sumsq[2], 538764);
+
+	KUNIT_ASSERT_EQ(test, adxl345_set_stats_window(adxl, 0), 0);
+	KUNIT_EXPECT_EQ(test, adxl->stream_users, 0);
+}
+
+/*
+ * Replayed at real time with every period 2% long, the estimate moves
+ * from nominal towards -19608 ppm by an eighth of the way per interval.
+ * Three intervals put it past a sixteenth and short of overshooting.
+ */
+static void adxl_test_drift(struct kunit *test)
+{
+	struct adxl_device *adxl = ((struct adxl_test *)test->priv)->adxl;
+	u64 period = ADXL345_RATE_PERIOD_NS(0x0C) * 102 / 100;
+	struct adxl_sample *samples;
+	struct file *file;
+	s32 ppm, target = -19608;
+	u32 mhz;
+	size_t i;
+
+	samples = adxl_test_samples(test, ADXL_TEST_DRIFT_SAMPLES);
+	for (i = 0; i < ADXL_TEST_DRIFT_SAMPLES; i++)
+		samples[i].timestamp = i * period;
+
+	KUNIT_ASSERT_EQ(test, adxl345_write_rate(adxl, 0x0C), 0x0C);
+	adxl_replay_set_speed(adxl, 1);
+	file = adxl_test_open(test, ADXL_MODE_SINGLE);
+	KUNIT_ASSERT_EQ(test,
+			adxl_test_write(file, samples,
+					ADXL_TEST_DRIFT_SAMPLES),
+			(ssize_t)(ADXL_TEST_DRIFT_SAMPLES * sizeof(*samples)));
+
+	/* Only the worker drains, at the watermark */
+	adxl_test_open(test, ADXL_MODE_BINARY);
+	msleep(ADXL_TEST_DRIFT_MS);
+
+	adxl345_get_odr(adxl, &mhz, &ppm);
+	kunit_info(test, "odr %u mHz, %d ppm\n", mhz, ppm);
+	KUNIT_EXPECT_LE(test, ppm, target / 16);
+	KUNIT_EXPECT_GE(test, ppm, target + target / 10);
+	KUNIT_EXPECT_LT(test, mhz, 400000U);
+
+	/* The worker drained all along, so it was busy but never saturated */
+	KUNIT_EXPECT_GT(test, atomic64_read(&adxl->busy_ns), 0);
+	KUNIT_EXPECT_LT(test, adxl345_worker_utilization(adxl), 1000U);
+}
+
+static void adxl_test_remove(void *adxl)
+{
+	adxl345_remove(adxl);
+}
+
+static int adxl_test_init(struct kunit *test)
+{
+	struct adxl_test *t;
+	struct device *dev;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	dev = kunit_device_register(test, "adxl-test");
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+
+	t->adxl = adxl_replay_create(dev);
+	if (IS_ERR(t->adxl))
+		return PTR_ERR(t->adxl);
+
+	/* Everything queued is due at once, the FIFO size caps each drain */
+	adxl_replay_set_speed(t->adxl, 0);
+	t->inode.i_cdev = &t->adxl->cdev;
+	test->priv = t;
+
+	return kunit_add_action_or_reset(test, adxl_test_remove, t->adxl);
+}
+
+static struct kunit_case adxl_test_cases[] = {
+	KUNIT_CASE(adxl_test_decode),
+	KUNIT_CASE(adxl_test_single),
+	KUNIT_CASE(adxl_test_stream_format),
+	KUNIT_CASE(adxl_test_rate_range),
+	KUNIT_CASE(adxl_test_raw),
+	KUNIT_CASE(adxl_test_overrun),
+	KUNIT_CASE(adxl_test_readers),
+	KUNIT_CASE(adxl_test_nowait),
+	KUNIT_CASE(adxl_test_ioctls),
+	KUNIT_CASE(adxl_test_mode_wakes_reader),
+	KUNIT_CASE(adxl_test_hot_paths),
+	KUNIT_CASE(adxl_test_runtime_pm),
+	KUNIT_CASE(adxl_test_events),
+	KUNIT_CASE(adxl_test_stats),
+	KUNIT_CASE_SLOW(adxl_test_drift),
+	{}
+};
+
+static struct kunit_suite adxl_test_suite = {
+	.name = "adxl",
+	.init = adxl_test_init,
+	.test_cases = adxl_test_cases,
+};
+
+kunit_test_suite(adxl_test_suite);
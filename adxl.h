@@ -8,27 +8,54 @@
 #include <linux/cdev.h>
 #include <linux/delay.h>
 #include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/idr.h>
 #include <linux/interrupt.h>
 #include <linux/ioctl.h>
+#include <linux/iopoll.h>
+#include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
+#include <linux/poll.h>
+#include <linux/pm_runtime.h>
 #include <linux/regmap.h>
 #include <linux/slab.h>
 #include <linux/spi/spi.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include "uadxl.h"
 
 #define ADXL_MAX_DEVICES 32
 #define ADXL_OF_COMPAT_ID 0xcafe
 #define ADXL_OF_COMPAT_DEVICE "zephyr,adxl345"
-#define ADXL_BUF_SIZE 1024
+#define ADXL_BUF_SIZE PAGE_SIZE
+#define ADXL_RING_SIZE 1024 /* Buffered samples per device, power of 2 */
+#define ADXL_RING_BYTES                 \
+	PAGE_ALIGN(sizeof(struct adxl_ring) + \
+		   ADXL_RING_SIZE * sizeof(struct adxl_sample))
+#define ADXL_LINE_MAX 64 /* Longest formatted stream line */
+#define ADXL_READ_BATCH (ADXL_BUF_SIZE / ADXL_LINE_MAX)
 
 #define ADXL345_REG_DEVID 0x00
+#define ADXL345_REG_THRESH_TAP 0x1D
 #define ADXL345_REG_OFSX 0x1E
 #define ADXL345_REG_OFSY 0x1F
 #define ADXL345_REG_OFSZ 0x20
 #define ADXL345_REG_OFS_AXIS(index) (ADXL345_REG_OFSX + (index))
+#define ADXL345_REG_DUR 0x21
+#define ADXL345_REG_LATENT 0x22
+#define ADXL345_REG_WINDOW 0x23
+#define ADXL345_REG_THRESH_ACT 0x24
+#define ADXL345_REG_THRESH_INACT 0x25
+#define ADXL345_REG_TIME_INACT 0x26
+#define ADXL345_REG_ACT_INACT_CTL 0x27
+#define ADXL345_REG_THRESH_FF 0x28
+#define ADXL345_REG_TIME_FF 0x29
+#define ADXL345_REG_TAP_AXES 0x2A
 #define ADXL345_REG_BW_RATE 0x2C
 #define ADXL345_REG_POWER_CTL 0x2D
 #define ADXL345_REG_DATA_FORMAT 0x31
@@ -38,6 +65,10 @@
 #define ADXL345_REG_DATA_AXIS(index) \
 	(ADXL345_REG_DATAX0 + (index) * sizeof(__le16))
 #define ADXL345_REG_INT_ENABLE 0x2E
+#define ADXL345_REG_INT_MAP 0x2F
+#define ADXL345_REG_INT_SOURCE 0x30
+#define ADXL345_REG_FIFO_CTL 0x38
+#define ADXL345_REG_FIFO_STATUS 0x39
 
 #define ADXL345_BW_RATE GENMASK(3, 0)
 
@@ -55,6 +86,14 @@
 #define ADXL345_DATA_FORMAT_8G 2
 #define ADXL345_DATA_FORMAT_16G 3
 
+#define ADXL345_FIFO_CTL_SAMPLES GENMASK(4, 0) /* Watermark level */
+#define ADXL345_FIFO_CTL_MODE GENMASK(7, 6)
+#define ADXL345_FIFO_BYPASS 0x00
+#define ADXL345_FIFO_STREAM 0x80
+#define ADXL345_FIFO_STATUS_ENTRIES GENMASK(5, 0)
+#define ADXL345_FIFO_SIZE 32
+#define ADXL345_FIFO_WATERMARK 16
+
 #define ADXL345_DEVID 0xE5
 
 #define ADXL345_INT_OVERRUN BIT(0)
@@ -66,23 +105,159 @@
 #define ADXL345_INT_SINGLE_TAP BIT(6)
 #define ADXL345_INT_DATA_READY BIT(7)
 
+/* Interrupt sources enabled through the events attribute, routed to INT2 */
+#define ADXL345_INT_EVENTS (ADXL_EVENT_ALL & ~ADXL_EVENT_OVERRUN)
+#define ADXL345_ACT_INACT_CTL_AC_XYZ 0xFF /* Relative to the start, all axes */
+#define ADXL345_TAP_AXES_XYZ 0x07
+
+#define ADXL345_SAMPLE_SIZE 6 /* DATAX0 to DATAZ1 */
+#define ADXL_RAW_SLOTS 256 /* Buffered FIFO drains per device, power of 2 */
+#define ADXL345_STATS_WINDOW_MAX_MS 60000
+
+/*
+ * Drift is measured over intervals of at least this long and this many
+ * samples, then IIR filtered. The sample count bounds the +-1 sample error
+ * of one interval to 1000 ppm however slow the rate, which the filter
+ * averages down.
+ */
+#define ADXL345_DRIFT_INTERVAL_NS (2 * NSEC_PER_SEC)
+#define ADXL345_DRIFT_MIN_SAMPLES 1000
+#define ADXL345_DRIFT_IIR_SHIFT 3
+#define ADXL345_DRIFT_MAX_DIV 10 /* Larger deviations are gaps, not drift */
+
+/* BW_RATE, POWER_CTL, INT_ENABLE and INT_MAP, restored in one burst */
+#define ADXL345_PM_BURST (ADXL345_REG_INT_MAP - ADXL345_REG_BW_RATE + 1)
+#define ADXL345_AUTOSUSPEND_MS 2000
+#define ADXL345_RESUME_TIMEOUT_US 100000 /* Bound on the first conversion */
+
+/* Output data rate period of a BW_RATE code, 3200Hz at code 0xF */
+#define ADXL345_RATE_PERIOD_NS(rate) \
+	((u64)(NSEC_PER_SEC / 3200) << (15 - ((rate) & ADXL345_BW_RATE)))
+
+/* Multicast groups of the generic netlink family, see ADXL_GENL_NAME */
+#define ADXL_NL_EVENTS 0
+#define ADXL_NL_SUMMARIES 1
+
+/* worker_priority values besides nice, map to sched_set_fifo{,_low}() */
+#define ADXL345_WORKER_FIFO_LOW 1
+#define ADXL345_WORKER_FIFO (MAX_RT_PRIO / 2)
+
+/* worker_utilization reports the last completed window of this length */
+#define ADXL345_UTIL_WINDOW_NS NSEC_PER_SEC
+
 // #define ENABLE_INTERRUPT
 
+struct adxl_replay;
+struct iio_dev;
+
+/* One FIFO drain as ADXL_MODE_RAW hands it out, data cut to hdr.count */
+struct adxl_raw_slot {
+	struct adxl_raw_burst hdr;
+	u8 data[ADXL345_FIFO_SIZE * ADXL345_SAMPLE_SIZE];
+};
+
+static_assert(ADXL_RAW_MAX_COUNT == ADXL345_FIFO_SIZE &&
+	      ADXL_RAW_SAMPLE_SIZE == ADXL345_SAMPLE_SIZE);
+
 struct adxl_device {
 	struct cdev cdev;
-	struct spi_device *spidev;
+	struct spi_device *spidev; /* NULL for replay devices */
+	struct adxl_replay *replay;
+	struct device *dev; /* Parent, SPI or replay platform device */
 	struct device *device;
 	struct regmap *regmap;
 	int irq;
 	int sample_rate;
 	int measurement_range;
+	u8 data_format; /* Last written DATA_FORMAT */
 	int x, y, z;
+	bool checked; /* Produced a sample since probe, see adxl345_check() */
+	s64 probe_start, probe_time; /* ns */
+
+	/* Streaming, samples drained from the FIFO into a ring */
+	struct mutex lock; /* Serializes stream start/stop */
+	struct mutex fifo_lock; /* Serializes FIFO drains */
+	spinlock_t ring_lock;
+	wait_queue_head_t wq;
+	struct kthread_worker *worker; /* Runs every stream drain */
+	struct kthread_work poll_work;
+	struct hrtimer poll_timer; /* Queues poll_work at the FIFO watermark */
+	bool polling; /* Whether poll_work drains and rearms poll_timer */
+	struct adxl_ring *shared; /* vmalloc_user() area userspace may mmap */
+	struct adxl_sample *ring; /* Slots within shared */
+	u32 head; /* Ring position of the next sample to be stored */
+	int stream_users;
+	int default_mode; /* Read mode of newly opened fds */
+	u8 fifo_buf[ADXL345_FIFO_SIZE * ADXL345_SAMPLE_SIZE];
+	struct adxl_raw_slot *raw_ring; /* Drains kept for ADXL_MODE_RAW */
+	u32 raw_head; /* Index of the next slot, under ring_lock */
+	u32 drained; /* Samples drained since probe, their seq, ring_lock */
+	int raw_users; /* Streams in ADXL_MODE_RAW, under lock */
+	struct iio_dev *indio_dev; /* NULL without CONFIG_IIO_KFIFO_BUF */
+	bool iio_buffered; /* Drains push into the IIO buffer */
+
+	/* Oscillator drift, under fifo_lock */
+	int drift_rate; /* BW_RATE code the estimate belongs to */
+	u64 period_q16; /* Measured sample period, ns in Q48.16 */
+	s64 drift_anchor; /* Drain time the count started at, 0 to restart */
+	u32 drift_count; /* Samples drained since drift_anchor */
+
+	/* Acquisition worker placement and load, set under lock */
+	int worker_cpu; /* -1 when unbound */
+	int worker_policy; /* SCHED_NORMAL or SCHED_FIFO */
+	int worker_prio; /* Nice, or ADXL345_WORKER_FIFO{,_LOW} */
+	atomic64_t busy_ns; /* Spent draining on the worker */
+	spinlock_t util_lock; /* Protects the utilization window */
+	s64 util_busy, util_time; /* busy_ns and time the window started at */
+	unsigned int util_permille; /* Of the last completed window */
+
+	/* Runtime PM, configuration saved on suspend */
+	u8 pm_regs[ADXL345_PM_BURST];
+	u8 pm_data_format, pm_fifo_ctl;
+	s64 resumed_at; /* Until the first valid sample, under ring_lock */
+	s64 resume_latency; /* Last resume to first valid sample, ns */
+
+	/* Windowed statistics, accumulated by the drain under ring_lock */
+	struct mutex stats_lock; /* Serializes window changes */
+	unsigned int stats_window_ms; /* 0 when disabled */
+	u64 stats_window_ns;
+	u32 stats_seq;
+	struct adxl_stats stats_acc; /* Window in progress */
+	struct adxl_stats stats; /* Last published window */
+
+	/* Interrupt events, which keep the sensor streaming while enabled */
+	struct mutex events_lock; /* Serializes enable changes */
+	unsigned int events; /* ADXL_EVENT_* enabled in INT_ENABLE */
+	atomic_t latched; /* ADXL_EVENT_* read from INT_SOURCE, not reported */
 };
 
+int adxl_register(struct adxl_device *adxl);
+void adxl_unregister(struct adxl_device *adxl);
+
 int adxl345_sysfs_init(struct adxl_device *);
 int adxl345_sysfs_deinit(struct adxl_device *);
 
+int adxl_netlink_init(void);
+void adxl_netlink_exit(void);
+bool adxl_netlink_listening(unsigned int group);
+void adxl_netlink_event(struct adxl_device *adxl, s64 timestamp, u32 seq,
+			u32 events);
+void adxl_netlink_summary(struct adxl_device *adxl);
+
+int adxl_replay_init(void);
+void adxl_replay_exit(void);
+struct adxl_device *adxl_replay_create(struct device *dev);
+ssize_t adxl_replay_write(struct adxl_device *adxl, struct iov_iter *from,
+			  bool nonblock);
+void adxl_replay_set_speed(struct adxl_device *adxl, unsigned int speed);
+
+extern const struct dev_pm_ops adxl345_pm_ops;
+
 int adxl345_probe(struct adxl_device *adxl);
+void adxl345_remove(struct adxl_device *adxl);
+int adxl345_check(struct adxl_device *adxl);
+int adxl345_pm_get(struct adxl_device *adxl);
+void adxl345_pm_put(struct adxl_device *adxl);
 int adxl345_update_axis(struct adxl_device *adxl);
 int adxl345_read_x(struct adxl_device *adxl);
 int adxl345_read_y(struct adxl_device *adxl);
@@ -92,4 +267,37 @@ int adxl345_read_range(struct adxl_device *adxl);
 int adxl345_write_range(struct adxl_device *adxl, u8 range);
 int adxl345_write_rate(struct adxl_device *adxl, u8 rate);
 int adxl345_enable(struct adxl_device *adxl);
-int adxl345_disable(struct adxl_device *adxl);
\ No newline at end of file
+int adxl345_disable(struct adxl_device *adxl);
+int adxl345_stream_start(struct adxl_device *adxl);
+void adxl345_stream_stop(struct adxl_device *adxl);
+int adxl345_drain_fifo(struct adxl_device *adxl);
+int adxl345_fetch_samples(struct adxl_device *adxl, u32 *tail,
+			  struct adxl_sample *out, int max);
+bool adxl345_samples_pending(struct adxl_device *adxl, u32 tail);
+int adxl345_raw_start(struct adxl_device *adxl);
+void adxl345_raw_stop(struct adxl_device *adxl);
+size_t adxl345_fetch_raw(struct adxl_device *adxl, u32 *tail, void *out,
+			 size_t len);
+bool adxl345_raw_pending(struct adxl_device *adxl, u32 tail);
+int adxl345_set_stats_window(struct adxl_device *adxl, unsigned int ms);
+int adxl345_set_events(struct adxl_device *adxl, unsigned int events);
+void adxl345_get_stats(struct adxl_device *adxl, struct adxl_stats *stats);
+void adxl345_get_odr(struct adxl_device *adxl, u32 *mhz, s32 *ppm);
+int adxl345_set_worker_cpu(struct adxl_device *adxl, int cpu);
+int adxl345_set_worker_priority(struct adxl_device *adxl, int policy,
+				int prio);
+unsigned int adxl345_worker_utilization(struct adxl_device *adxl);
+
+#if IS_ENABLED(CONFIG_IIO_KFIFO_BUF)
+int adxl_iio_probe(struct adxl_device *adxl);
+void adxl_iio_push(struct adxl_device *adxl, u32 seq, int n);
+#else
+static inline int adxl_iio_probe(struct adxl_device *adxl)
+{
+	return 0;
+}
+
+static inline void adxl_iio_push(struct adxl_device *adxl, u32 seq, int n)
+{
+}
+#endif
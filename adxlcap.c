@@ -0,0 +1,443 @@
+/**
+ * @file adxlcap.c
+ * @brief Capture format writer and memory-mapped reader, see adxlcap.h
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "adxlcap.h"
+
+#define VARINT_MAX        3  /* A zigzag int16 delta needs at most 17 bits */
+#define VARINT64_MAX      10 /* A zigzag int64 needs up to 64 */
+#define SAMPLE_MAX        (3 * VARINT_MAX + VARINT64_MAX)
+#define WRITER_BUF_SIZE   (64 * 1024)
+
+_Static_assert(sizeof(struct adxl_cap_header) == 64, "capture header layout");
+_Static_assert(sizeof(struct adxl_cap_block) == 40, "capture block layout");
+_Static_assert(sizeof(struct adxl_cap_index) == 24, "capture index layout");
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline uint64_t zigzag64(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag64(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline size_t put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+/* max_shift bounds the encoding, 14 for the 17 bits of an axis delta */
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t max_shift,
+                                        uint64_t *v)
+{
+    uint32_t shift = 0;
+
+    *v = 0;
+    while (p < end && shift <= max_shift) {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ Writer */
+
+struct adxl_cap_writer {
+    FILE *file;
+    struct adxl_cap_header header;
+    struct adxl_cap_block block;
+    uint8_t *payload;
+    int16_t prev[3];
+    int64_t prev_timestamp, prev_step;
+    struct adxl_cap_index *index;
+    size_t index_cap;
+    uint64_t offset; /* Where the next block goes */
+};
+
+static int writer_flush_block(struct adxl_cap_writer *w)
+{
+    struct adxl_cap_index *entry;
+
+    if (!w->block.count) return 0;
+
+    if (w->header.block_count == w->index_cap) {
+        size_t cap = w->index_cap ? w->index_cap * 2 : 256;
+        struct adxl_cap_index *index = realloc(w->index, cap * sizeof(*index));
+        if (!index) return -1;
+        w->index = index;
+        w->index_cap = cap;
+    }
+
+    if (fwrite(&w->block, sizeof(w->block), 1, w->file) != 1 ||
+        fwrite(w->payload, 1, w->block.payload_size, w->file) != w->block.payload_size)
+        return -1;
+
+    entry = &w->index[w->header.block_count++];
+    entry->offset = w->offset;
+    entry->first_timestamp = w->block.first_timestamp;
+    entry->first_seq = w->block.first_seq;
+    entry->count = w->block.count;
+
+    w->offset += sizeof(w->block) + w->block.payload_size;
+    memset(&w->block, 0, sizeof(w->block));
+    return 0;
+}
+
+struct adxl_cap_writer *adxl_cap_create(const char *path, const struct adxl_cap_header *info)
+{
+    struct adxl_cap_writer *w = calloc(1, sizeof(*w));
+
+    if (!w) return NULL;
+
+    w->header = *info;
+    memset(w->header.magic, 0, sizeof(w->header.magic));
+    memcpy(w->header.magic, ADXL_CAP_MAGIC, sizeof(ADXL_CAP_MAGIC));
+    w->header.version = ADXL_CAP_VERSION;
+    w->header.header_size = sizeof(w->header);
+    w->header.block_count = 0;
+    w->header.index_offset = 0;
+    if (!w->header.block_samples) w->header.block_samples = ADXL_CAP_BLOCK_SAMPLES;
+
+    w->payload = malloc((size_t)w->header.block_samples * SAMPLE_MAX);
+    w->file = fopen(path, "wbe");
+    if (!w->payload || !w->file) goto fail;
+
+    setvbuf(w->file, NULL, _IOFBF, WRITER_BUF_SIZE);
+
+    if (fwrite(&w->header, sizeof(w->header), 1, w->file) != 1) goto fail;
+    w->offset = sizeof(w->header);
+    return w;
+
+fail:
+    if (w->file) fclose(w->file);
+    free(w->payload);
+    free(w);
+    return NULL;
+}
+
+int adxl_cap_write(struct adxl_cap_writer *w, const struct adxl_sample *samples, size_t count)
+{
+    struct adxl_cap_block *b = &w->block;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct adxl_sample *s = &samples[i];
+
+        /* Start a new block on a sequence gap, when full or when the anchor gets old */
+        if (b->count && (s->seq != b->first_seq + b->count || b->count == w->header.block_samples ||
+                         s->timestamp - b->first_timestamp >= ADXL_CAP_BLOCK_NS)) {
+            if (writer_flush_block(w) < 0) return -1;
+        }
+
+        if (!b->count) {
+            if (!w->header.start_time) w->header.start_time = s->timestamp;
+            b->magic = ADXL_CAP_BLOCK_MAGIC;
+            b->first_seq = s->seq;
+            b->first_timestamp = s->timestamp;
+            b->first[0] = s->x;
+            b->first[1] = s->y;
+            b->first[2] = s->z;
+            w->prev_step = 0;
+        } else {
+            uint8_t *p = w->payload + b->payload_size;
+            int64_t step = s->timestamp - w->prev_timestamp;
+
+            p += put_varint(p, zigzag(s->x - w->prev[0]));
+            p += put_varint(p, zigzag(s->y - w->prev[1]));
+            p += put_varint(p, zigzag(s->z - w->prev[2]));
+            p += put_varint(p, zigzag64(step - w->prev_step));
+            b->payload_size = p - w->payload;
+            w->prev_step = step;
+        }
+
+        b->last_timestamp = s->timestamp;
+        w->prev_timestamp = s->timestamp;
+        b->count++;
+        w->prev[0] = s->x;
+        w->prev[1] = s->y;
+        w->prev[2] = s->z;
+    }
+
+    return 0;
+}
+
+int adxl_cap_flush(struct adxl_cap_writer *w)
+{
+    if (writer_flush_block(w) < 0) return -1;
+    return fflush(w->file);
+}
+
+void adxl_cap_set_odr(struct adxl_cap_writer *w, uint32_t odr_mhz)
+{
+    w->header.odr_mhz = odr_mhz;
+}
+
+int adxl_cap_close(struct adxl_cap_writer *w)
+{
+    int ret = 0;
+
+    if (writer_flush_block(w) < 0) ret = -1;
+
+    if (!ret) {
+        w->header.index_offset = w->offset;
+        if (fwrite(w->index, sizeof(*w->index), w->header.block_count, w->file) !=
+                w->header.block_count ||
+            fseek(w->file, 0, SEEK_SET) < 0 ||
+            fwrite(&w->header, sizeof(w->header), 1, w->file) != 1)
+            ret = -1;
+    }
+
+    if (fclose(w->file) != 0) ret = -1;
+    free(w->index);
+    free(w->payload);
+    free(w);
+    return ret;
+}
+
+/* ------------------------------------------------------------------ Reader */
+
+struct adxl_cap_reader {
+    const uint8_t *map;
+    size_t len;
+    const struct adxl_cap_header *header;
+    const struct adxl_cap_index *index;
+    struct adxl_cap_index *rebuilt; /* Owned index of an unterminated capture */
+    size_t blocks;
+    size_t block; /* Cursor */
+    uint32_t pos;
+    struct adxl_sample *decoded;
+    size_t decoded_block;
+};
+
+static int reader_rebuild_index(struct adxl_cap_reader *r)
+{
+    uint64_t offset = r->header->header_size;
+    size_t cap = 0;
+
+    while (offset + sizeof(struct adxl_cap_block) <= r->len) {
+        const struct adxl_cap_block *b = (const void *)(r->map + offset);
+        uint64_t next = offset + sizeof(*b) + b->payload_size;
+
+        if (b->magic != ADXL_CAP_BLOCK_MAGIC || next > r->len) break;
+
+        if (r->blocks == cap) {
+            struct adxl_cap_index *index;
+            cap = cap ? cap * 2 : 256;
+            if (!(index = realloc(r->rebuilt, cap * sizeof(*index)))) return -1;
+            r->rebuilt = index;
+        }
+
+        r->rebuilt[r->blocks++] = (struct adxl_cap_index){
+            .offset = offset,
+            .first_timestamp = b->first_timestamp,
+            .first_seq = b->first_seq,
+            .count = b->count,
+        };
+        offset = next;
+    }
+
+    r->index = r->rebuilt;
+    return 0;
+}
+
+struct adxl_cap_reader *adxl_cap_open(const char *path)
+{
+    struct adxl_cap_reader *r = calloc(1, sizeof(*r));
+    struct stat st;
+    int fd;
+
+    if (!r) return NULL;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) goto fail;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        goto fail;
+    }
+
+    if ((r->len = st.st_size) < sizeof(struct adxl_cap_header)) {
+        close(fd);
+        errno = EPROTO;
+        goto fail;
+    }
+
+    r->map = mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        goto fail;
+    }
+
+    r->header = (const void *)r->map;
+    if (memcmp(r->header->magic, ADXL_CAP_MAGIC, sizeof(ADXL_CAP_MAGIC)) ||
+        r->header->version != ADXL_CAP_VERSION || r->header->header_size < sizeof(*r->header) ||
+        !r->header->block_samples) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    if (r->header->index_offset &&
+        r->header->index_offset + (uint64_t)r->header->block_count * sizeof(*r->index) <= r->len) {
+        r->index = (const void *)(r->map + r->header->index_offset);
+        r->blocks = r->header->block_count;
+    } else if (reader_rebuild_index(r) < 0) {
+        goto fail;
+    }
+
+    if (!(r->decoded = malloc(r->header->block_samples * sizeof(*r->decoded)))) goto fail;
+    r->decoded_block = SIZE_MAX;
+
+    madvise((void *)r->map, r->len, MADV_SEQUENTIAL);
+    return r;
+
+fail:
+    adxl_cap_release(r);
+    return NULL;
+}
+
+void adxl_cap_release(struct adxl_cap_reader *r)
+{
+    if (!r) return;
+    if (r->map) munmap((void *)r->map, r->len);
+    free(r->rebuilt);
+    free(r->decoded);
+    free(r);
+}
+
+const struct adxl_cap_header *adxl_cap_info(const struct adxl_cap_reader *r)
+{
+    return r->header;
+}
+
+size_t adxl_cap_blocks(const struct adxl_cap_reader *r)
+{
+    return r->blocks;
+}
+
+const struct adxl_cap_index *adxl_cap_block_index(const struct adxl_cap_reader *r, size_t block)
+{
+    return block < r->blocks ? &r->index[block] : NULL;
+}
+
+static int reader_decode_block(struct adxl_cap_reader *r, size_t block)
+{
+    const struct adxl_cap_block *b;
+    const uint8_t *p, *end;
+    struct adxl_sample *s = r->decoded;
+    int64_t step = 0;
+    uint64_t v[4];
+
+    if (r->decoded_block == block) return 0;
+
+    if (r->index[block].offset + sizeof(*b) > r->len) return errno = EPROTO, -1;
+    b = (const void *)(r->map + r->index[block].offset);
+    p = (const uint8_t *)(b + 1);
+    end = p + b->payload_size;
+    if (b->magic != ADXL_CAP_BLOCK_MAGIC || !b->count || b->count > r->header->block_samples ||
+        b->count != r->index[block].count || (size_t)(end - r->map) > r->len)
+        return errno = EPROTO, -1;
+
+    s[0] = (struct adxl_sample){ .timestamp = b->first_timestamp,
+                                 .seq = b->first_seq,
+                                 .x = b->first[0],
+                                 .y = b->first[1],
+                                 .z = b->first[2] };
+
+    for (uint32_t i = 1; i < b->count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (!(p = get_varint(p, end, 14, &v[axis]))) return errno = EPROTO, -1;
+        }
+        if (!(p = get_varint(p, end, 63, &v[3]))) return errno = EPROTO, -1;
+
+        step += unzigzag64(v[3]);
+        s[i].timestamp = s[i - 1].timestamp + step;
+        s[i].seq = b->first_seq + i;
+        s[i].x = s[i - 1].x + unzigzag(v[0]);
+        s[i].y = s[i - 1].y + unzigzag(v[1]);
+        s[i].z = s[i - 1].z + unzigzag(v[2]);
+        s[i].reserved = 0;
+    }
+
+    r->decoded_block = block;
+    return 0;
+}
+
+int adxl_cap_seek(struct adxl_cap_reader *r, int64_t timestamp)
+{
+    size_t lo = 0, hi = r->blocks;
+
+    /* Last block starting at or before timestamp */
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (r->index[mid].first_timestamp <= timestamp)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    r->block = lo;
+    r->pos = 0;
+    if (!r->blocks) return 0;
+
+    if (reader_decode_block(r, lo) < 0) return -1;
+    while (r->pos < r->index[lo].count && r->decoded[r->pos].timestamp < timestamp) r->pos++;
+
+    if (r->pos == r->index[lo].count) {
+        r->block++;
+        r->pos = 0;
+    }
+    return 0;
+}
+
+ssize_t adxl_cap_read(struct adxl_cap_reader *r, struct adxl_sample *buf, size_t count)
+{
+    size_t copied = 0;
+
+    while (copied < count && r->block < r->blocks) {
+        uint32_t n;
+
+        if (reader_decode_block(r, r->block) < 0) return copied ? (ssize_t)copied : -1;
+
+        n = r->index[r->block].count - r->pos;
+        if (n > count - copied) n = count - copied;
+
+        memcpy(buf + copied, r->decoded + r->pos, n * sizeof(*buf));
+        copied += n;
+        r->pos += n;
+
+        if (r->pos == r->index[r->block].count) {
+            r->block++;
+            r->pos = 0;
+        }
+    }
+
+    return copied;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file adxlcap.h
+ * @brief Compact binary capture format for ADXL345 sample streams
+ *
+ * A capture file is little-endian and laid out as:
+ *
+ *   struct adxl_cap_header        Fixed, at offset 0
+ *   block 0 .. block N-1          struct adxl_cap_block + payload each
+ *   struct adxl_cap_index[N]      At header.index_offset, written on close
+ *
+ * A block holds a run of consecutive sequence numbers, at most
+ * header.block_samples samples and ADXL_CAP_BLOCK_NS of time. Its header
+ * stores the first sample verbatim plus first and last timestamps; the
+ * payload holds, for every following sample, the x, y and z differences to
+ * the previous sample and the change of the timestamp step (delta of delta,
+ * 0 within a drain), each zigzag-mapped to unsigned and written as a LEB128
+ * varint (one byte for |delta| < 64). Timestamps round-trip exactly, drain
+ * jitter and rate changes included. A sequence gap (driver overrun) always
+ * starts a new block.
+ *
+ * header.index_offset stays 0 until the writer is closed. Readers of an
+ * unterminated capture (power loss, crash) rebuild the index by walking
+ * the block headers.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "uadxl.h"
+
+#define ADXL_CAP_MAGIC         "ADXLCAP"
+#define ADXL_CAP_VERSION       1
+#define ADXL_CAP_BLOCK_MAGIC   0x4b4c4241 /* "ABLK" */
+#define ADXL_CAP_BLOCK_SAMPLES 1024
+#define ADXL_CAP_BLOCK_NS      1000000000LL
+
+struct adxl_cap_header {
+    char magic[8]; /* ADXL_CAP_MAGIC, NUL padded */
+    uint16_t version;
+    uint16_t header_size;
+    uint8_t range; /* ADXL_RANGE_* / DATA_FORMAT range bits */
+    uint8_t rate;  /* BW_RATE code */
+    int8_t offset[3]; /* OFSX, OFSY, OFSZ */
+    uint8_t reserved0;
+    uint16_t device; /* N of /dev/adxlN */
+    uint32_t block_samples;
+    uint32_t block_count; /* Valid once index_offset is set */
+    uint32_t odr_mhz; /* Measured data rate when recording stopped, 0 unknown */
+    int64_t start_time; /* CLOCK_MONOTONIC ns, driver timestamps */
+    int64_t wall_time;  /* CLOCK_REALTIME ns when recording started */
+    uint64_t index_offset;
+    uint8_t reserved[8];
+};
+
+struct adxl_cap_block {
+    uint32_t magic; /* ADXL_CAP_BLOCK_MAGIC */
+    uint32_t count;
+    uint32_t first_seq;
+    uint32_t payload_size;
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+    int16_t first[3];
+    uint16_t reserved;
+};
+
+struct adxl_cap_index {
+    uint64_t offset; /* Of the struct adxl_cap_block */
+    int64_t first_timestamp;
+    uint32_t first_seq;
+    uint32_t count;
+};
+
+/* Streaming writer, buffered through stdio */
+struct adxl_cap_writer;
+
+struct adxl_cap_writer *adxl_cap_create(const char *path, const struct adxl_cap_header *info);
+int adxl_cap_write(struct adxl_cap_writer *writer, const struct adxl_sample *samples, size_t count);
+int adxl_cap_flush(struct adxl_cap_writer *writer);
+/* Header odr_mhz written on close, known only once the driver estimate settled */
+void adxl_cap_set_odr(struct adxl_cap_writer *writer, uint32_t odr_mhz);
+/* Writes the index and patches the header; frees the writer in any case */
+int adxl_cap_close(struct adxl_cap_writer *writer);
+
+/* Memory-mapped reader */
+struct adxl_cap_reader;
+
+struct adxl_cap_reader *adxl_cap_open(const char *path);
+void adxl_cap_release(struct adxl_cap_reader *reader);
+const struct adxl_cap_header *adxl_cap_info(const struct adxl_cap_reader *reader);
+size_t adxl_cap_blocks(const struct adxl_cap_reader *reader);
+const struct adxl_cap_index *adxl_cap_block_index(const struct adxl_cap_reader *reader, size_t block);
+/* Position the cursor at the first sample at or after timestamp */
+int adxl_cap_seek(struct adxl_cap_reader *reader, int64_t timestamp);
+/* Decode up to count samples from the cursor, returns 0 at the end */
+ssize_t adxl_cap_read(struct adxl_cap_reader *reader, struct adxl_sample *buf, size_t count);
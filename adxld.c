@@ -0,0 +1,209 @@
+/**
+ * @file adxld.c
+ * @brief Fan-out daemon, sole reader of /dev/adxlN publishing to shared memory
+ *
+ * Each sensor gets a POSIX shared-memory ring named ADXL_SHM_NAME, laid out as
+ * struct adxl_ring. Subscribers map it read-only with adxl_shm_attach() and
+ * sleep on the ring head with adxl_ring_wait(); they never touch the device.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "adxlraw.h"
+#include "libadxl.h"
+
+#define MAX_SENSORS   32
+#define DEFAULT_SLOTS 8192
+#define READ_BATCH    256
+#define RAW_BATCH     (READ_BATCH / ADXL_RAW_MAX_COUNT * ADXL_RAW_BURST_MAX)
+
+struct sensor {
+    struct adxl_dev *dev;
+    struct adxl_ring *ring;
+    size_t ring_len;
+    char shm_name[32];
+    bool raw; /* Read ADXL_MODE_RAW and decode here */
+    unsigned long long published;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n slots] [-r rate] [-c] [-u] [index...]\n"
+            "  -n slots  Samples per shared ring, power of 2 (default %d)\n"
+            "  -r rate   BW_RATE code programmed into every sensor\n"
+            "  -c        Spread the driver acquisition workers over the online CPUs\n"
+            "  -u        Decode samples in userspace from raw FIFO bursts\n"
+            "Publishes every probed sensor when no index is given.\n",
+            prog, DEFAULT_SLOTS);
+}
+
+static int sensor_start(struct sensor *s, int index, uint32_t slots, int rate, bool raw)
+{
+    int fd;
+
+    s->raw = raw;
+    if (!(s->dev = adxl_open(index, O_NONBLOCK))) return -1;
+    if (rate >= 0 && adxl_set_rate(s->dev, rate) < 0) return -1;
+    if (adxl_set_mode(s->dev, raw ? ADXL_MODE_RAW : ADXL_MODE_BINARY) < 0) return -1;
+
+    snprintf(s->shm_name, sizeof(s->shm_name), ADXL_SHM_NAME, index);
+    s->ring_len = adxl_ring_bytes(slots);
+
+    fd = shm_open(s->shm_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    if (ftruncate(fd, s->ring_len) < 0 ||
+        (s->ring = mmap(NULL, s->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+            MAP_FAILED) {
+        s->ring = NULL;
+        close(fd);
+        shm_unlink(s->shm_name);
+        return -1;
+    }
+    close(fd);
+
+    adxl_ring_init(s->ring, slots);
+    return 0;
+}
+
+static void sensor_stop(struct sensor *s)
+{
+    if (s->ring) {
+        munmap(s->ring, s->ring_len);
+        shm_unlink(s->shm_name);
+    }
+    adxl_close(s->dev);
+}
+
+/* Move everything the driver has buffered into the shared ring */
+static int sensor_pump(struct sensor *s)
+{
+    struct adxl_sample batch[READ_BATCH];
+    uint8_t raw[RAW_BATCH];
+    ssize_t n;
+
+    for (;;) {
+        /* Raw reads leave the driver copying FIFO bursts, decoding happens here */
+        if (s->raw) {
+            if ((n = adxl_read_raw(s->dev, raw, sizeof(raw))) > 0)
+                n = adxl_raw_decode(raw, n, batch, READ_BATCH, NULL);
+        } else {
+            n = adxl_read_samples(s->dev, batch, READ_BATCH);
+        }
+        if (n <= 0) break;
+
+        adxl_ring_publish(s->ring, batch, n);
+        s->published += n;
+    }
+
+    return n < 0 && errno != EAGAIN ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sensor sensors[MAX_SENSORS] = { 0 };
+    struct pollfd pfds[MAX_SENSORS];
+    int indices[MAX_SENSORS];
+    uint32_t slots = DEFAULT_SLOTS;
+    int count = 0, rate = -1, opt, status = EXIT_SUCCESS;
+    bool spread = false, raw = false;
+
+    while ((opt = getopt(argc, argv, "n:r:cuh")) != -1) {
+        switch (opt) {
+        case 'n':
+            slots = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'c':
+            spread = true;
+            break;
+        case 'u':
+            raw = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!slots || (slots & (slots - 1))) {
+        fprintf(stderr, "Ring size must be a power of 2\n");
+        return EXIT_FAILURE;
+    }
+
+    for (; optind < argc && count < MAX_SENSORS; optind++) indices[count++] = atoi(argv[optind]);
+
+    if (!count && (count = adxl_discover(indices, MAX_SENSORS)) <= 0) {
+        fprintf(stderr, "No ADXL345 devices found\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Round robin, so drains of different sensors run in parallel */
+    if (spread) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        for (int i = 0; i < count && cpus > 0; i++)
+            if (adxl_sysfs_write(indices[i], "worker_cpu", i % cpus) < 0)
+                fprintf(stderr, "adxl%d: worker_cpu: %s\n", indices[i], strerror(errno));
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    for (int i = 0; i < count; i++) {
+        if (sensor_start(&sensors[i], indices[i], slots, rate, raw) < 0) {
+            fprintf(stderr, "adxl%d: %s\n", indices[i], strerror(errno));
+            status = EXIT_FAILURE;
+            count = i + 1;
+            goto out;
+        }
+        pfds[i] = (struct pollfd){ .fd = adxl_fd(sensors[i].dev), .events = POLLIN };
+        printf("adxl%d: publishing to %s (%u slots)\n", indices[i], sensors[i].shm_name, slots);
+    }
+
+    while (running) {
+        if (poll(pfds, count, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            if (sensor_pump(&sensors[i]) < 0) {
+                fprintf(stderr, "adxl%d: %s\n", indices[i], strerror(errno));
+                status = EXIT_FAILURE;
+                running = 0;
+            }
+        }
+    }
+
+out:
+    for (int i = 0; i < count; i++) {
+        if (sensors[i].dev)
+            printf("adxl%d: %llu samples published\n", indices[i], sensors[i].published);
+        sensor_stop(&sensors[i]);
+    }
+
+    return status;
+}
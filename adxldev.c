@@ -2,7 +2,7 @@
 
 /* Global Driver Data */
 static int major_number;
-static atomic_t device_count = ATOMIC_INIT(0);
+static DEFINE_IDA(adxl_minors); /* Probes may run concurrently */
 static struct class *adxl_class;
 extern struct file_operations adxl_fops;
 
@@ -14,50 +14,32 @@ static const struct of_device_id adxl_of_match[] = {
 
 MODULE_DEVICE_TABLE(of, adxl_of_match);
 
-static int adxl_probe(struct spi_device *c)
+int adxl_register(struct adxl_device *adxl_device)
 {
 	int ret;
-	struct device *dev = &c->dev;
-
-	/* 1. ADXL Device Creation */
-	struct adxl_device *adxl_device =
-		devm_kzalloc(dev, sizeof(struct adxl_device), GFP_KERNEL);
-
-	if (!adxl_device)
-		return -ENOMEM;
-
-	adxl_device->spidev = c;
-	spi_set_drvdata(c, adxl_device);
-
-	/* 2. Setup the sensor */
-	if ((ret = adxl345_probe(adxl_device)))
-		return dev_err_probe(dev, ret, "Sensor setup failed\n");
-
-#if 0
-	if (device_property_read_u32(&c->dev, "test",
-				     &adxl_device->test))
-		return dev_err(dev,
-			       "Driver needs 'test' property to be specified!\n"),
-		       -EINVAL;
-#endif
+	struct device *dev = adxl_device->dev;
 
 	/* 3. Character Device preparations */
-	int minor = atomic_fetch_inc(&device_count);
+	int minor = ida_alloc_max(&adxl_minors, ADXL_MAX_DEVICES - 1,
+				  GFP_KERNEL);
 	dev_t devno = MKDEV(major_number, minor);
 
+	if (minor < 0)
+		return dev_err_probe(dev, minor, "Out of minors\n");
+
 	cdev_init(&adxl_device->cdev, &adxl_fops);
 	ret = cdev_add(&adxl_device->cdev, devno, 1);
 	if (ret < 0) {
-		atomic_dec(&device_count);
-		return dev_err_probe(&c->dev, ret, "Failed to add cdev\n");
+		ida_free(&adxl_minors, minor);
+		return dev_err_probe(dev, ret, "Failed to add cdev\n");
 	}
 
 	adxl_device->device =
 		device_create(adxl_class, dev, devno, NULL, "adxl%d", minor);
 	if (IS_ERR(adxl_device->device)) {
 		cdev_del(&adxl_device->cdev);
-		atomic_dec(&device_count);
-		return dev_err_probe(&c->dev, PTR_ERR(adxl_device->device),
+		ida_free(&adxl_minors, minor);
+		return dev_err_probe(dev, PTR_ERR(adxl_device->device),
 				     "Failed to create device\n");
 	}
 
@@ -65,19 +47,58 @@ static int adxl_probe(struct spi_device *c)
 	dev_set_drvdata(adxl_device->device, adxl_device);
 	adxl345_sysfs_init(adxl_device);
 
-	dev_info(&c->dev, "Device probed!\n");
+	adxl_device->probe_time = ktime_get_ns() - adxl_device->probe_start;
+	dev_info(dev, "Device probed in %lld us!\n",
+		 div_s64(adxl_device->probe_time, NSEC_PER_USEC));
 
 	return 0;
 }
 
-static void adxl_remove(struct spi_device *c)
+void adxl_unregister(struct adxl_device *adxl_device)
 {
-	struct adxl_device *adxl_device = spi_get_drvdata(c);
 	dev_t devno = adxl_device->cdev.dev;
 	adxl345_sysfs_deinit(adxl_device);
 	cdev_del(&adxl_device->cdev);
+	/* Acquisition notifies the class device, stop it first */
+	adxl345_remove(adxl_device);
 	device_destroy(adxl_class, devno);
-	atomic_dec(&device_count);
+	ida_free(&adxl_minors, MINOR(devno));
+}
+
+static int adxl_probe(struct spi_device *c)
+{
+	int ret;
+	struct device *dev = &c->dev;
+
+	/* 1. ADXL Device Creation */
+	struct adxl_device *adxl_device =
+		devm_kzalloc(dev, sizeof(struct adxl_device), GFP_KERNEL);
+
+	if (!adxl_device)
+		return -ENOMEM;
+
+	adxl_device->spidev = c;
+	adxl_device->dev = dev;
+	spi_set_drvdata(c, adxl_device);
+
+	/* 2. Setup the sensor */
+	if ((ret = adxl345_probe(adxl_device)))
+		return dev_err_probe(dev, ret, "Sensor setup failed\n");
+
+#if 0
+	if (device_property_read_u32(&c->dev, "test",
+				     &adxl_device->test))
+		return dev_err(dev,
+			       "Driver needs 'test' property to be specified!\n"),
+		       -EINVAL;
+#endif
+
+	return adxl_register(adxl_device);
+}
+
+static void adxl_remove(struct spi_device *c)
+{
+	adxl_unregister(spi_get_drvdata(c));
 	dev_info(&c->dev, "Client removed!\n");
 }
 
@@ -87,6 +108,8 @@ static struct spi_driver adxl_driver = {
     .driver = {
         .name = "adxl",
         .of_match_table = adxl_of_match,
+        .pm = pm_ptr(&adxl345_pm_ops),
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.owner = THIS_MODULE,
     },
 };
@@ -111,18 +134,34 @@ static int __init adxl_init(void)
 		goto fail_class;
 	}
 
+	ret = adxl_netlink_init();
+	if (ret < 0) {
+		pr_err("Failed to register netlink family\n");
+		goto fail_netlink;
+	}
+
 	ret = spi_register_driver(&adxl_driver);
 	if (ret < 0) {
 		pr_err("Failed to register platform driver\n");
 		goto fail_platform;
 	}
 
+	ret = adxl_replay_init();
+	if (ret < 0) {
+		pr_err("Failed to create replay devices\n");
+		goto fail_replay;
+	}
+
 	pr_info("Driver loaded successfully with major number %d\n",
 		major_number);
 
 	return 0;
 
+fail_replay:
+	spi_unregister_driver(&adxl_driver);
 fail_platform:
+	adxl_netlink_exit();
+fail_netlink:
 	class_destroy(adxl_class);
 fail_class:
 	unregister_chrdev_region(dev, ADXL_MAX_DEVICES);
@@ -131,7 +170,9 @@ fail_class:
 
 static void __exit adxl_exit(void)
 {
+	adxl_replay_exit();
 	spi_unregister_driver(&adxl_driver);
+	adxl_netlink_exit();
 	class_destroy(adxl_class);
 	unregister_chrdev_region(MKDEV(major_number, 0), ADXL_MAX_DEVICES);
 
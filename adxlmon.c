@@ -0,0 +1,253 @@
+/**
+ * @file adxlmon.c
+ * @brief Streams one or more sensors through adxlvib and prints per-window features as CSV
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adxlvib.h"
+#include "libadxl.h"
+
+#define MAX_SENSORS    32
+#define READ_BATCH     256
+#define DEFAULT_WINDOW 512
+
+struct sensor {
+    int index;
+    struct adxl_dev *dev;
+    struct adxl_vib *vib;
+    unsigned int bands;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-w window] [-o hop] [-r rate] [-b edges] [index...]\n"
+            "       %s -e\n"
+            "  -w window  Samples per FFT window, power of 2 (default %d)\n"
+            "  -o hop     Samples between windows (default window / 2)\n"
+            "  -r rate    BW_RATE code programmed into every sensor\n"
+            "  -b edges   Comma separated band edges in Hz (default 0,10,50,200,800,nyquist)\n"
+            "Analyzes every probed sensor when no index is given. Prints\n"
+            "sensor,timestamp,seq,axis,rms,peak,crest,dominant_hz,band_power... per axis and window.\n"
+            "  -e         Print the driver's netlink feed of all sensors instead, as\n"
+            "             event,sensor,timestamp,seq,bits and\n"
+            "             summary,sensor,window,count,start,end,min xyz,max xyz,mean xyz lines\n",
+            prog, prog, DEFAULT_WINDOW);
+}
+
+static int parse_edges(const char *arg, struct adxl_vib_config *config)
+{
+    char *end;
+
+    config->bands = 0;
+    for (;;) {
+        if (config->bands > ADXL_VIB_MAX_BANDS) return -1;
+        config->band_edges[config->bands] = strtof(arg, &end);
+        if (end == arg) return -1;
+        if (*end != ',') break;
+        config->bands++;
+        arg = end + 1;
+    }
+
+    return config->bands ? 0 : -1;
+}
+
+static void print_features(const struct adxl_vib_features *f, void *arg)
+{
+    const struct sensor *s = arg;
+
+    for (int axis = 0; axis < 3; axis++) {
+        printf("%d,%lld,%u,%c,%.5f,%.5f,%.3f,%.1f", s->index, (long long)f->timestamp, f->seq,
+               'x' + axis, f->rms[axis], f->peak[axis], f->crest[axis], f->dominant_hz[axis]);
+        for (unsigned int band = 0; band < s->bands; band++)
+            printf(",%.6f", f->band_power[axis][band]);
+        putchar('\n');
+    }
+}
+
+static int sensor_start(struct sensor *s, int index, int rate, struct adxl_vib_config config,
+                        bool default_edges)
+{
+    enum adxl_rate current;
+    int odr_mhz;
+
+    s->index = index;
+    if (!(s->dev = adxl_open(index, O_NONBLOCK))) return -1;
+    if (rate >= 0 && adxl_set_rate(s->dev, rate) < 0) return -1;
+    if (adxl_get_rate(s->dev, &current) < 0) return -1;
+    /* BINARY starts the stream, so odr_mhz below is of the current rate */
+    if (adxl_set_mode(s->dev, ADXL_MODE_BINARY) < 0) return -1;
+
+    /* Bins land on the measured rate once the driver estimate settled */
+    config.rate_hz = adxl_rate_hz(current);
+    if (adxl_sysfs_read(index, "odr_mhz", &odr_mhz) == 0 && odr_mhz > 0 &&
+        fabs(odr_mhz / 1000.0 - config.rate_hz) < config.rate_hz / 10)
+        config.rate_hz = odr_mhz / 1000.0;
+    if (default_edges) {
+        /* Keep the default edges below Nyquist, which closes the last band */
+        while (config.bands > 1 && config.band_edges[config.bands - 1] >= config.rate_hz / 2)
+            config.bands--;
+        config.band_edges[config.bands] = config.rate_hz / 2;
+    }
+
+    if (!(s->vib = adxl_vib_create(&config))) return -1;
+    s->bands = config.bands;
+    return 0;
+}
+
+static int sensor_pump(struct sensor *s)
+{
+    struct adxl_sample batch[READ_BATCH];
+    ssize_t n;
+
+    while ((n = adxl_read_samples(s->dev, batch, READ_BATCH)) > 0)
+        adxl_vib_push(s->vib, batch, n, print_features, s);
+
+    return n < 0 && errno != EAGAIN ? -1 : 0;
+}
+
+/* Events and statistics summaries of every sensor from one netlink socket */
+static int print_feed(void)
+{
+    struct adxl_nl_msg msg;
+    const struct adxl_stats *st = &msg.stats;
+    struct pollfd pfd;
+    int fd, ret;
+
+    if ((fd = adxl_nl_open(true, true)) < 0) {
+        perror("netlink");
+        return EXIT_FAILURE;
+    }
+    pfd = (struct pollfd){ .fd = fd, .events = POLLIN };
+
+    while (running) {
+        /* poll(2) rather than a restarted recv(2) lets signals end the loop */
+        if (poll(&pfd, 1, -1) < 0 || (ret = adxl_nl_recv(fd, &msg)) < 0) {
+            if (errno == EINTR) continue;
+            perror("netlink");
+            break;
+        }
+        if (!ret) continue;
+
+        if (msg.cmd == ADXL_CMD_EVENT) {
+            printf("event,%u,%lld,%u,0x%02x\n", msg.device, (long long)msg.timestamp, msg.seq,
+                   msg.events);
+        } else {
+            printf("summary,%u,%u,%u,%lld,%lld,%d,%d,%d,%d,%d,%d,%.2f,%.2f,%.2f\n", msg.device,
+                   st->seq, st->count, (long long)st->start, (long long)st->end, st->min[0],
+                   st->min[1], st->min[2], st->max[0], st->max[1], st->max[2],
+                   st->mean[0] / 256.0, st->mean[1] / 256.0, st->mean[2] / 256.0);
+        }
+        fflush(stdout);
+    }
+
+    close(fd);
+    return running ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    struct adxl_vib_config config = {
+        .window = DEFAULT_WINDOW,
+        .bands = 5,
+        .band_edges = { 0, 10, 50, 200, 800 },
+    };
+    struct sensor sensors[MAX_SENSORS] = { 0 };
+    struct pollfd pfds[MAX_SENSORS];
+    int indices[MAX_SENSORS];
+    int count = 0, rate = -1, opt, status = EXIT_SUCCESS;
+    bool default_edges = true;
+
+    while ((opt = getopt(argc, argv, "w:o:r:b:eh")) != -1) {
+        switch (opt) {
+        case 'w':
+            config.window = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            config.hop = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'b':
+            if (parse_edges(optarg, &config) < 0) {
+                fprintf(stderr, "Bad band edges, up to %d bands\n", ADXL_VIB_MAX_BANDS);
+                return EXIT_FAILURE;
+            }
+            default_edges = false;
+            break;
+        case 'e':
+            signal(SIGINT, handle_signal);
+            signal(SIGTERM, handle_signal);
+            return print_feed();
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!config.hop) config.hop = config.window / 2;
+
+    for (; optind < argc && count < MAX_SENSORS; optind++) indices[count++] = atoi(argv[optind]);
+
+    if (!count && (count = adxl_discover(indices, MAX_SENSORS)) <= 0) {
+        fprintf(stderr, "No ADXL345 devices found\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    for (int i = 0; i < count; i++) {
+        if (sensor_start(&sensors[i], indices[i], rate, config, default_edges) < 0) {
+            fprintf(stderr, "adxl%d: %s\n", indices[i], strerror(errno));
+            status = EXIT_FAILURE;
+            count = i + 1;
+            goto out;
+        }
+        pfds[i] = (struct pollfd){ .fd = adxl_fd(sensors[i].dev), .events = POLLIN };
+    }
+
+    while (running) {
+        if (poll(pfds, count, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            if (sensor_pump(&sensors[i]) < 0) {
+                fprintf(stderr, "adxl%d: %s\n", indices[i], strerror(errno));
+                status = EXIT_FAILURE;
+                running = 0;
+            }
+        }
+    }
+
+out:
+    for (int i = 0; i < count; i++) {
+        adxl_vib_destroy(sensors[i].vib);
+        adxl_close(sensors[i].dev);
+    }
+
+    return status;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file adxlraw.c
+ * @brief Raw FIFO burst decoding, see adxlraw.h
+ */
+#include "adxlraw.h"
+
+#include <string.h>
+
+#define LITTLE_ENDIAN_HOST (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && LITTLE_ENDIAN_HOST
+#include <arm_neon.h>
+#define RAW_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define RAW_SSSE3 1
+#endif
+
+/* DATA_FORMAT bits, as in the driver */
+#define DATA_FORMAT_RANGE    0x03
+#define DATA_FORMAT_JUSTIFY  0x04
+#define DATA_FORMAT_FULL_RES 0x08
+
+int adxl_raw_shift(uint8_t data_format)
+{
+    int bits = 10;
+
+    if (!(data_format & DATA_FORMAT_JUSTIFY)) return 0;
+    /* Full resolution gains a bit per range step, 13 bits at 16g */
+    if (data_format & DATA_FORMAT_FULL_RES) bits += data_format & DATA_FORMAT_RANGE;
+    return 16 - bits;
+}
+
+#if RAW_SSSE3
+/*
+ * pshufb masks gathering one axis out of three loads of eight interleaved samples, per
+ * axis and load; -1 zeroes the lane, so the three results simply OR together.
+ */
+static const int8_t unpack_masks[3][3][16] = {
+    {
+        { 0, 1, 6, 7, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, 2, 3, 8, 9, 14, 15, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 4, 5, 10, 11 },
+    },
+    {
+        { 2, 3, 8, 9, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, 4, 5, 10, 11, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 6, 7, 12, 13 },
+    },
+    {
+        { 4, 5, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, 0, 1, 6, 7, 12, 13, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 3, 8, 9, 14, 15 },
+    },
+};
+#endif
+
+void adxl_raw_unpack(const uint8_t *raw, size_t count, int shift, int16_t *x, int16_t *y,
+                     int16_t *z)
+{
+    int16_t *axis[3] = { x, y, z };
+    size_t i = 0;
+
+#if RAW_NEON
+    const int16x8_t vshift = vdupq_n_s16(-shift);
+
+    for (; i + 8 <= count; i += 8) {
+        int16x8x3_t v = vld3q_s16((const int16_t *)(raw + i * ADXL_RAW_SAMPLE_SIZE));
+
+        for (int a = 0; a < 3; a++) vst1q_s16(axis[a] + i, vshlq_s16(v.val[a], vshift));
+    }
+#elif RAW_SSSE3
+    const __m128i vshift = _mm_cvtsi32_si128(shift);
+
+    for (; i + 8 <= count; i += 8) {
+        const uint8_t *p = raw + i * ADXL_RAW_SAMPLE_SIZE;
+        __m128i v[3] = {
+            _mm_loadu_si128((const __m128i *)p),
+            _mm_loadu_si128((const __m128i *)(p + 16)),
+            _mm_loadu_si128((const __m128i *)(p + 32)),
+        };
+
+        for (int a = 0; a < 3; a++) {
+            __m128i out = _mm_setzero_si128();
+
+            for (int l = 0; l < 3; l++) {
+                __m128i mask = _mm_loadu_si128((const __m128i *)unpack_masks[a][l]);
+
+                out = _mm_or_si128(out, _mm_shuffle_epi8(v[l], mask));
+            }
+            _mm_storeu_si128((__m128i *)(axis[a] + i), _mm_sra_epi16(out, vshift));
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        const uint8_t *p = raw + i * ADXL_RAW_SAMPLE_SIZE;
+
+        for (int a = 0; a < 3; a++)
+            axis[a][i] = (int16_t)(p[2 * a] | p[2 * a + 1] << 8) >> shift;
+    }
+}
+
+size_t adxl_raw_decode(const void *buf, size_t len, struct adxl_sample *out, size_t max,
+                       size_t *used)
+{
+    int16_t axis[3][ADXL_RAW_MAX_COUNT];
+    const uint8_t *p = buf;
+    struct adxl_raw_burst hdr;
+    size_t off = 0, n = 0;
+
+    while (len - off >= sizeof(hdr)) {
+        memcpy(&hdr, p + off, sizeof(hdr));
+        if (hdr.count > ADXL_RAW_MAX_COUNT ||
+            len - off - sizeof(hdr) < (size_t)hdr.count * ADXL_RAW_SAMPLE_SIZE ||
+            max - n < hdr.count)
+            break;
+
+        adxl_raw_unpack(p + off + sizeof(hdr), hdr.count, adxl_raw_shift(hdr.data_format),
+                        axis[0], axis[1], axis[2]);
+
+        for (uint32_t i = 0; i < hdr.count; i++, n++) {
+            out[n].timestamp =
+                hdr.timestamp + (hdr.odr_mhz ? (int64_t)i * 1000000000000LL / hdr.odr_mhz : 0);
+            out[n].seq = hdr.seq + i;
+            out[n].x = axis[0][i];
+            out[n].y = axis[1][i];
+            out[n].z = axis[2][i];
+            out[n].reserved = 0;
+        }
+
+        off += sizeof(hdr) + (size_t)hdr.count * ADXL_RAW_SAMPLE_SIZE;
+    }
+
+    if (used) *used = off;
+    return n;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file adxlraw.h
+ * @brief Userspace decoding of ADXL_MODE_RAW reads, the FIFO bursts as drained
+ *
+ * In raw mode the driver hands out every FIFO drain as a struct adxl_raw_burst followed
+ * by count undecoded DATAX0..DATAZ1 bursts, and leaves decoding to the reader.
+ * adxl_raw_unpack() deinterleaves bursts into per-axis arrays eight samples per step,
+ * with NEON vld3 or SSSE3 shuffles where the compiler targets them and a scalar fallback.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uadxl.h"
+
+/* Right shift that turns left-justified (JUSTIFY) data of a DATA_FORMAT into LSB */
+int adxl_raw_shift(uint8_t data_format);
+
+/* Deinterleave count little-endian 6-byte bursts into x, y and z */
+void adxl_raw_unpack(const uint8_t *raw, size_t count, int shift, int16_t *x, int16_t *y,
+                     int16_t *z);
+
+/*
+ * Decode the whole bursts at the start of buf, as long as their samples fit in max.
+ * Returns the number of samples written; *used is set to the bytes consumed.
+ */
+size_t adxl_raw_decode(const void *buf, size_t len, struct adxl_sample *out, size_t max,
+                       size_t *used);
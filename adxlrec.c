@@ -0,0 +1,289 @@
+/**
+ * @file adxlrec.c
+ * @brief Records a sensor into the capture format of adxlcap.h, prints and replays captures
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adxlcap.h"
+#include "libadxl.h"
+
+#define READ_BATCH      256
+#define FLUSH_PERIOD_NS 1000000000LL
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-d index | -s index] [-t seconds] [-b samples] out.cap\n"
+            "       %s -p [-S timestamp] in.cap\n"
+            "       %s -i in.cap\n"
+            "       %s -R index [-x speed] [-S timestamp] in.cap\n"
+            "  -d index  Record /dev/adxlN (default 0)\n"
+            "  -s index  Record the shared ring adxld publishes for adxlN\n"
+            "  -t secs   Stop after this many seconds (default: until SIGINT)\n"
+            "  -b count  Samples per block (default %d)\n"
+            "  -p        Print a capture as timestamp,seq,x,y,z lines\n"
+            "  -S ts     Start printing at this timestamp (ns)\n"
+            "  -i        Print the capture header and block summary\n"
+            "  -R index  Play a capture back through replay device /dev/adxlN\n"
+            "  -x speed  Replay speed, 1 real time, N times faster, 0 as fast as read (default 1)\n",
+            prog, prog, prog, prog, ADXL_CAP_BLOCK_SAMPLES);
+}
+
+static int64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fill_header(struct adxl_cap_header *header, int index)
+{
+    char path[128];
+    int rate, range, ofs[3];
+    FILE *file;
+
+    header->device = index;
+    header->wall_time = now_ns(CLOCK_REALTIME);
+    if (adxl_sysfs_read(index, "rate", &rate) == 0) header->rate = rate;
+    if (adxl_sysfs_read(index, "range", &range) == 0) header->range = range;
+
+    snprintf(path, sizeof(path), ADXL_CLASS_PATH "/adxl%d/offset", index);
+    if ((file = fopen(path, "re"))) {
+        if (fscanf(file, "%d %d %d", &ofs[0], &ofs[1], &ofs[2]) == 3) {
+            for (int i = 0; i < 3; i++) header->offset[i] = ofs[i];
+        }
+        fclose(file);
+    }
+}
+
+static int record(const char *path, int index, bool shm, int seconds, uint32_t block_samples)
+{
+    struct adxl_cap_header header = { .block_samples = block_samples };
+    struct adxl_sample batch[READ_BATCH];
+    struct adxl_ring_reader reader = { 0 };
+    struct adxl_cap_writer *writer;
+    struct adxl_dev *dev = NULL;
+    unsigned long long total = 0;
+    int64_t deadline, last_flush;
+    ssize_t n;
+    int odr;
+
+    if (shm ? adxl_shm_attach(index, &reader) < 0 : !(dev = adxl_open(index, 0))) {
+        fprintf(stderr, "adxl%d: %s\n", index, strerror(errno));
+        return -1;
+    }
+
+    fill_header(&header, index);
+    if (!(writer = adxl_cap_create(path, &header))) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        shm ? adxl_shm_detach(&reader) : adxl_close(dev);
+        return -1;
+    }
+
+    last_flush = now_ns(CLOCK_MONOTONIC);
+    deadline = seconds > 0 ? last_flush + seconds * 1000000000LL : INT64_MAX;
+
+    while (running && now_ns(CLOCK_MONOTONIC) < deadline) {
+        if (shm) {
+            if (adxl_ring_wait(&reader, 1000) < 0) break;
+            n = adxl_ring_read(&reader, batch, READ_BATCH);
+        } else {
+            n = adxl_read_samples(dev, batch, READ_BATCH);
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("read");
+            break;
+        }
+
+        if (adxl_cap_write(writer, batch, n) < 0) {
+            perror("write");
+            break;
+        }
+        total += n;
+
+        /* Bound what a power cut can take with it */
+        if (now_ns(CLOCK_MONOTONIC) - last_flush >= FLUSH_PERIOD_NS) {
+            adxl_cap_flush(writer);
+            last_flush = now_ns(CLOCK_MONOTONIC);
+        }
+    }
+
+    /* Read before closing, which may stop the stream and its estimate */
+    if (adxl_sysfs_read(index, "odr_mhz", &odr) == 0) adxl_cap_set_odr(writer, odr);
+    shm ? adxl_shm_detach(&reader) : adxl_close(dev);
+
+    if (adxl_cap_close(writer) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(stderr, "%llu samples recorded to %s\n", total, path);
+    return 0;
+}
+
+static int print_capture(const char *path, bool info_only, int64_t start)
+{
+    struct adxl_sample batch[READ_BATCH];
+    const struct adxl_cap_header *header;
+    struct adxl_cap_reader *reader;
+    ssize_t n;
+
+    if (!(reader = adxl_cap_open(path))) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    header = adxl_cap_info(reader);
+    if (info_only) {
+        size_t blocks = adxl_cap_blocks(reader);
+        unsigned long long samples = 0;
+
+        for (size_t i = 0; i < blocks; i++) samples += adxl_cap_block_index(reader, i)->count;
+
+        printf("device:  adxl%u\n", header->device);
+        printf("rate:    %u (%.2f Hz)\n", header->rate, adxl_rate_hz(header->rate));
+        if (header->odr_mhz) printf("odr:     %.3f Hz measured\n", header->odr_mhz / 1000.0);
+        printf("range:   %u\n", header->range);
+        printf("offset:  %d %d %d\n", header->offset[0], header->offset[1], header->offset[2]);
+        printf("start:   %lld\n", (long long)header->start_time);
+        printf("blocks:  %zu%s\n", blocks, header->index_offset ? "" : " (unterminated)");
+        printf("samples: %llu\n", samples);
+    } else {
+        if (start && adxl_cap_seek(reader, start) < 0) perror("seek");
+        while ((n = adxl_cap_read(reader, batch, READ_BATCH)) > 0) {
+            for (ssize_t i = 0; i < n; i++)
+                printf("%lld,%u,%d,%d,%d\n", (long long)batch[i].timestamp, batch[i].seq,
+                       batch[i].x, batch[i].y, batch[i].z);
+        }
+        if (n < 0) perror("read");
+    }
+
+    adxl_cap_release(reader);
+    return 0;
+}
+
+static int replay(const char *path, int index, int speed, int64_t start)
+{
+    struct adxl_sample batch[READ_BATCH];
+    const struct adxl_cap_header *header;
+    struct adxl_cap_reader *reader;
+    unsigned long long total = 0;
+    struct adxl_dev *dev;
+    ssize_t n, done, ret = 0;
+
+    if (!(reader = adxl_cap_open(path))) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    header = adxl_cap_info(reader);
+    if (!(dev = adxl_open(index, 0)) || adxl_set_rate(dev, header->rate) < 0 ||
+        adxl_set_range(dev, header->range) < 0 ||
+        adxl_sysfs_write(index, "replay_speed", speed) < 0) {
+        fprintf(stderr, "adxl%d: %s\n", index, strerror(errno));
+        adxl_close(dev);
+        adxl_cap_release(reader);
+        return -1;
+    }
+
+    if (start && adxl_cap_seek(reader, start) < 0) perror("seek");
+
+    /* Writes block while the device queue is full, so this paces itself */
+    while (running && (n = adxl_cap_read(reader, batch, READ_BATCH)) > 0) {
+        for (done = 0; running && done < n; done += ret) {
+            if ((ret = adxl_write_samples(dev, batch + done, n - done)) < 0) {
+                if (errno == EINTR) {
+                    ret = 0;
+                    continue;
+                }
+                perror("write");
+                goto out;
+            }
+        }
+        total += n;
+    }
+
+out:
+    adxl_close(dev);
+    adxl_cap_release(reader);
+    fprintf(stderr, "%llu samples replayed to adxl%d\n", total, index);
+    return ret < 0 ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    enum { RECORD, PRINT, INFO, REPLAY } action = RECORD;
+    uint32_t block_samples = ADXL_CAP_BLOCK_SAMPLES;
+    int index = 0, seconds = 0, speed = 1, opt;
+    int64_t start = 0;
+    bool shm = false;
+
+    while ((opt = getopt(argc, argv, "d:s:t:b:pS:iR:x:h")) != -1) {
+        switch (opt) {
+        case 's':
+            shm = true;
+            /* fall through */
+        case 'd':
+            index = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'b':
+            block_samples = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            action = PRINT;
+            break;
+        case 'S':
+            start = strtoll(optarg, NULL, 0);
+            break;
+        case 'i':
+            action = INFO;
+            break;
+        case 'R':
+            action = REPLAY;
+            index = atoi(optarg);
+            break;
+        case 'x':
+            speed = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (action == PRINT || action == INFO)
+        return print_capture(argv[optind], action == INFO, start) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    if (action == REPLAY)
+        return replay(argv[optind], index, speed, start) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    return record(argv[optind], index, shm, seconds, block_samples) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
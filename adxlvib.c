@@ -0,0 +1,402 @@
+/**
+ * @file adxlvib.c
+ * @brief Vibration feature extraction, see adxlvib.h
+ */
+#include "adxlvib.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VIB_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VIB_SSE2 1
+#endif
+
+#define VIB_ALIGN 16
+
+struct adxl_vib {
+    struct adxl_vib_config config;
+    uint32_t fill; /* Samples buffered */
+    uint32_t next_seq;
+
+    /* Buffered samples, one array per axis */
+    int16_t *axis[3];
+    int64_t *timestamp;
+    uint32_t *seq;
+
+    /* Transform state, x + iy in buffer 0 and z in buffer 1 */
+    float *hann;
+    float *re[2], *im[2];
+    float *tw_re, *tw_im; /* Per stage, the stage of half h starts at h - 1 */
+    uint32_t *bitrev;
+    float power_norm[2]; /* Bins 1..N/2-1, then DC and Nyquist */
+    float *power[3];     /* Per axis, N/2 + 1 bins */
+    uint32_t band_lo[ADXL_VIB_MAX_BANDS], band_hi[ADXL_VIB_MAX_BANDS];
+};
+
+static void *alloc_aligned(size_t size)
+{
+    return aligned_alloc(VIB_ALIGN, (size + VIB_ALIGN - 1) & ~(size_t)(VIB_ALIGN - 1));
+}
+
+/*
+ * out[i] = (in[i] - mean) * scale * hann[i], also returns the sum of squares and the
+ * largest magnitude of (in[i] - mean) * scale. n is a multiple of 8.
+ */
+static void convert(const int16_t *in, float mean, float scale, const float *hann, float *out,
+                    size_t n, float *sumsq, float *peak)
+{
+    float sum = 0, max = 0;
+    size_t i = 0;
+
+#if VIB_NEON
+    float32x4_t vmean = vdupq_n_f32(mean), vscale = vdupq_n_f32(scale);
+    float32x4_t acc = vdupq_n_f32(0), vpeak = vdupq_n_f32(0);
+    float lanes[4];
+
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(in + i);
+        float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        float32x4_t b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+
+        a = vmulq_f32(vsubq_f32(a, vmean), vscale);
+        b = vmulq_f32(vsubq_f32(b, vmean), vscale);
+        acc = vmlaq_f32(vmlaq_f32(acc, a, a), b, b);
+        vpeak = vmaxq_f32(vpeak, vmaxq_f32(vabsq_f32(a), vabsq_f32(b)));
+        vst1q_f32(out + i, vmulq_f32(a, vld1q_f32(hann + i)));
+        vst1q_f32(out + i + 4, vmulq_f32(b, vld1q_f32(hann + i + 4)));
+    }
+
+    vst1q_f32(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    vst1q_f32(lanes, vpeak);
+    for (int lane = 0; lane < 4; lane++)
+        if (lanes[lane] > max) max = lanes[lane];
+#elif VIB_SSE2
+    __m128 vmean = _mm_set1_ps(mean), vscale = _mm_set1_ps(scale);
+    __m128 acc = _mm_setzero_ps(), vpeak = _mm_setzero_ps();
+    __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    float lanes[4];
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_load_si128((const __m128i *)(in + i));
+        /* Sign extend by placing each int16 in the upper half, then shifting down */
+        __m128 a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+
+        a = _mm_mul_ps(_mm_sub_ps(a, vmean), vscale);
+        b = _mm_mul_ps(_mm_sub_ps(b, vmean), vscale);
+        acc = _mm_add_ps(acc, _mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)));
+        vpeak = _mm_max_ps(vpeak, _mm_max_ps(_mm_and_ps(a, absmask), _mm_and_ps(b, absmask)));
+        _mm_store_ps(out + i, _mm_mul_ps(a, _mm_load_ps(hann + i)));
+        _mm_store_ps(out + i + 4, _mm_mul_ps(b, _mm_load_ps(hann + i + 4)));
+    }
+
+    _mm_storeu_ps(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_ps(lanes, vpeak);
+    for (int lane = 0; lane < 4; lane++)
+        if (lanes[lane] > max) max = lanes[lane];
+#endif
+
+    for (; i < n; i++) {
+        float v = (in[i] - mean) * scale;
+        sum += v * v;
+        if (fabsf(v) > max) max = fabsf(v);
+        out[i] = v * hann[i];
+    }
+
+    *sumsq = sum;
+    *peak = max;
+}
+
+/* count butterflies of one group: a' = a + w b, b' = a - w b */
+static void butterflies(float *ar, float *ai, float *br, float *bi, const float *wr,
+                        const float *wi, size_t count)
+{
+    size_t k = 0;
+
+#if VIB_NEON
+    for (; k + 4 <= count; k += 4) {
+        float32x4_t xr = vld1q_f32(br + k), xi = vld1q_f32(bi + k);
+        float32x4_t cr = vld1q_f32(wr + k), ci = vld1q_f32(wi + k);
+        float32x4_t tr = vmlsq_f32(vmulq_f32(xr, cr), xi, ci);
+        float32x4_t ti = vmlaq_f32(vmulq_f32(xr, ci), xi, cr);
+        float32x4_t yr = vld1q_f32(ar + k), yi = vld1q_f32(ai + k);
+
+        vst1q_f32(br + k, vsubq_f32(yr, tr));
+        vst1q_f32(bi + k, vsubq_f32(yi, ti));
+        vst1q_f32(ar + k, vaddq_f32(yr, tr));
+        vst1q_f32(ai + k, vaddq_f32(yi, ti));
+    }
+#elif VIB_SSE2
+    for (; k + 4 <= count; k += 4) {
+        __m128 xr = _mm_loadu_ps(br + k), xi = _mm_loadu_ps(bi + k);
+        __m128 cr = _mm_loadu_ps(wr + k), ci = _mm_loadu_ps(wi + k);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+        __m128 yr = _mm_loadu_ps(ar + k), yi = _mm_loadu_ps(ai + k);
+
+        _mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+        _mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+        _mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+        _mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+    }
+#endif
+
+    for (; k < count; k++) {
+        float tr = br[k] * wr[k] - bi[k] * wi[k];
+        float ti = br[k] * wi[k] + bi[k] * wr[k];
+
+        br[k] = ar[k] - tr;
+        bi[k] = ai[k] - ti;
+        ar[k] += tr;
+        ai[k] += ti;
+    }
+}
+
+/* In-place iterative radix-2 FFT on split real and imaginary arrays */
+static void fft(const struct adxl_vib *vib, float *re, float *im)
+{
+    uint32_t n = vib->config.window;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t j = vib->bitrev[i];
+        if (i < j) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (uint32_t half = 1; half < n; half <<= 1) {
+        const float *wr = vib->tw_re + half - 1, *wi = vib->tw_im + half - 1;
+
+        for (uint32_t base = 0; base < n; base += 2 * half)
+            butterflies(re + base, im + base, re + base + half, im + base + half, wr, wi, half);
+    }
+}
+
+/* Power of bin k of the real axes packed as x + iy (imag = false for x, true for y) */
+static float packed_power(const float *re, const float *im, uint32_t n, uint32_t k, bool imag)
+{
+    uint32_t m = (n - k) & (n - 1);
+    float a, b;
+
+    if (!imag) {
+        a = re[k] + re[m];
+        b = im[k] - im[m];
+    } else {
+        a = im[k] + im[m];
+        b = re[k] - re[m];
+    }
+
+    return (a * a + b * b) * 0.25f;
+}
+
+static void analyze(struct adxl_vib *vib, struct adxl_vib_features *out)
+{
+    const struct adxl_vib_config *config = &vib->config;
+    uint32_t n = config->window, bins = n / 2 + 1;
+    float **power = vib->power;
+
+    out->timestamp = vib->timestamp[0];
+    out->seq = vib->seq[0];
+
+    /* x and y share a complex transform, z gets its own with a zero imaginary part */
+    for (int axis = 0; axis < 3; axis++) {
+        float *dst = axis == 0 ? vib->re[0] : axis == 1 ? vib->im[0] : vib->re[1];
+        int64_t total = 0;
+        float sumsq, peak;
+
+        for (uint32_t i = 0; i < n; i++) total += vib->axis[axis][i];
+
+        convert(vib->axis[axis], (float)total / n, config->scale, vib->hann, dst, n, &sumsq,
+                &peak);
+
+        out->rms[axis] = sqrtf(sumsq / n);
+        out->peak[axis] = peak;
+        out->crest[axis] = out->rms[axis] > 0 ? peak / out->rms[axis] : 0;
+    }
+    memset(vib->im[1], 0, n * sizeof(float));
+
+    fft(vib, vib->re[0], vib->im[0]);
+    fft(vib, vib->re[1], vib->im[1]);
+
+    for (uint32_t k = 0; k < bins; k++) {
+        float norm = k == 0 || k == n / 2 ? vib->power_norm[1] : vib->power_norm[0];
+
+        power[0][k] = packed_power(vib->re[0], vib->im[0], n, k, false) * norm;
+        power[1][k] = packed_power(vib->re[0], vib->im[0], n, k, true) * norm;
+        power[2][k] = (vib->re[1][k] * vib->re[1][k] + vib->im[1][k] * vib->im[1][k]) * norm;
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        uint32_t best = 1;
+
+        for (uint32_t k = 2; k < bins; k++)
+            if (power[axis][k] > power[axis][best]) best = k;
+        out->dominant_hz[axis] = best * config->rate_hz / n;
+
+        for (uint32_t band = 0; band < config->bands; band++) {
+            float sum = 0;
+            for (uint32_t k = vib->band_lo[band]; k < vib->band_hi[band]; k++)
+                sum += power[axis][k];
+            out->band_power[axis][band] = sum;
+        }
+    }
+}
+
+struct adxl_vib *adxl_vib_create(const struct adxl_vib_config *config)
+{
+    uint32_t n = config->window, bits = 0;
+    struct adxl_vib *vib;
+    double window_power = 0;
+
+    if (n < ADXL_VIB_MIN_WINDOW || n > ADXL_VIB_MAX_WINDOW || (n & (n - 1)) || !config->hop ||
+        config->hop > n || config->rate_hz <= 0 || config->bands > ADXL_VIB_MAX_BANDS) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    for (uint32_t band = 0; band < config->bands; band++) {
+        if (config->band_edges[band + 1] <= config->band_edges[band]) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    if (!(vib = calloc(1, sizeof(*vib)))) return NULL;
+    vib->config = *config;
+    if (!vib->config.scale) vib->config.scale = ADXL_VIB_FULL_RES_G;
+
+    for (int axis = 0; axis < 3; axis++) {
+        vib->axis[axis] = alloc_aligned(n * sizeof(int16_t));
+        vib->power[axis] = malloc((n / 2 + 1) * sizeof(float));
+    }
+    vib->timestamp = malloc(n * sizeof(*vib->timestamp));
+    vib->seq = malloc(n * sizeof(*vib->seq));
+    vib->hann = alloc_aligned(n * sizeof(float));
+    for (int i = 0; i < 2; i++) {
+        vib->re[i] = alloc_aligned(n * sizeof(float));
+        vib->im[i] = alloc_aligned(n * sizeof(float));
+    }
+    vib->tw_re = alloc_aligned(n * sizeof(float));
+    vib->tw_im = alloc_aligned(n * sizeof(float));
+    vib->bitrev = malloc(n * sizeof(*vib->bitrev));
+
+    if (!vib->axis[0] || !vib->axis[1] || !vib->axis[2] || !vib->power[0] || !vib->power[1] ||
+        !vib->power[2] || !vib->timestamp || !vib->seq ||
+        !vib->hann || !vib->re[0] || !vib->im[0] || !vib->re[1] || !vib->im[1] || !vib->tw_re ||
+        !vib->tw_im || !vib->bitrev) {
+        adxl_vib_destroy(vib);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        vib->hann[i] = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / n);
+        window_power += (double)vib->hann[i] * vib->hann[i];
+    }
+
+    /* Scaled so band powers of a window add up to its mean square */
+    vib->power_norm[0] = 2 / (n * window_power);
+    vib->power_norm[1] = 1 / (n * window_power);
+
+    for (uint32_t half = 1; half < n; half <<= 1) {
+        for (uint32_t k = 0; k < half; k++) {
+            vib->tw_re[half - 1 + k] = cos(-M_PI * k / half);
+            vib->tw_im[half - 1 + k] = sin(-M_PI * k / half);
+        }
+    }
+
+    while ((1u << bits) < n) bits++;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t r = 0;
+        for (uint32_t b = 0; b < bits; b++)
+            if (i & (1u << b)) r |= 1u << (bits - 1 - b);
+        vib->bitrev[i] = r;
+    }
+
+    for (uint32_t band = 0; band < config->bands; band++) {
+        double lo = ceil(config->band_edges[band] * n / config->rate_hz);
+        double hi = ceil(config->band_edges[band + 1] * n / config->rate_hz);
+
+        /* DC is removed before the transform, leave it out of every band */
+        vib->band_lo[band] = fmin(fmax(lo, 1), n / 2 + 1);
+        vib->band_hi[band] = fmin(fmax(hi, 1), n / 2 + 1);
+    }
+
+    return vib;
+}
+
+void adxl_vib_destroy(struct adxl_vib *vib)
+{
+    if (!vib) return;
+
+    for (int axis = 0; axis < 3; axis++) {
+        free(vib->axis[axis]);
+        free(vib->power[axis]);
+    }
+    for (int i = 0; i < 2; i++) {
+        free(vib->re[i]);
+        free(vib->im[i]);
+    }
+    free(vib->timestamp);
+    free(vib->seq);
+    free(vib->hann);
+    free(vib->tw_re);
+    free(vib->tw_im);
+    free(vib->bitrev);
+    free(vib);
+}
+
+void adxl_vib_reset(struct adxl_vib *vib)
+{
+    vib->fill = 0;
+}
+
+int adxl_vib_push(struct adxl_vib *vib, const struct adxl_sample *samples, size_t count,
+                  adxl_vib_fn fn, void *arg)
+{
+    uint32_t n = vib->config.window, hop = vib->config.hop, keep = n - hop;
+    struct adxl_vib_features features;
+    int windows = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct adxl_sample *s = &samples[i];
+
+        /* A window must be contiguous, start over after an overrun */
+        if (vib->fill && s->seq != vib->next_seq) vib->fill = 0;
+        vib->next_seq = s->seq + 1;
+
+        vib->axis[0][vib->fill] = s->x;
+        vib->axis[1][vib->fill] = s->y;
+        vib->axis[2][vib->fill] = s->z;
+        vib->timestamp[vib->fill] = s->timestamp;
+        vib->seq[vib->fill] = s->seq;
+
+        if (++vib->fill < n) continue;
+
+        analyze(vib, &features);
+        fn(&features, arg);
+        windows++;
+
+        for (int axis = 0; axis < 3; axis++)
+            memmove(vib->axis[axis], vib->axis[axis] + hop, keep * sizeof(int16_t));
+        memmove(vib->timestamp, vib->timestamp + hop, keep * sizeof(*vib->timestamp));
+        memmove(vib->seq, vib->seq + hop, keep * sizeof(*vib->seq));
+        vib->fill = keep;
+    }
+
+    return windows;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file adxlvib.h
+ * @brief Windowed vibration features (RMS, peak, crest factor, FFT band power) per axis
+ *
+ * Samples are pushed as they arrive and kept per axis as int16 arrays (structure of
+ * arrays). Every hop samples, once a full window is buffered, the window is converted to
+ * float with the mean removed and a Hann window applied, transformed and reduced to
+ * struct adxl_vib_features, which is handed to the callback. x and y share one complex
+ * FFT, z uses a second; the conversion and butterflies are vectorized with NEON or SSE2
+ * where the compiler targets them, with a scalar fallback.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uadxl.h"
+
+#define ADXL_VIB_MAX_BANDS  8
+#define ADXL_VIB_MIN_WINDOW 16
+#define ADXL_VIB_MAX_WINDOW 8192
+#define ADXL_VIB_FULL_RES_G 0.0039f /* g per LSB in full resolution mode */
+
+struct adxl_vib_config {
+    uint32_t window;  /* Samples per FFT, power of 2 */
+    uint32_t hop;     /* Samples between window starts, window / 2 for 50% overlap */
+    double rate_hz;   /* Output data rate, maps bins to Hz */
+    float scale;      /* g per LSB, 0 for ADXL_VIB_FULL_RES_G */
+    uint32_t bands;   /* Number of bands, up to ADXL_VIB_MAX_BANDS */
+    float band_edges[ADXL_VIB_MAX_BANDS + 1]; /* Hz, ascending, bands + 1 edges */
+};
+
+/* Axis-major features of one window; time domain values are of the mean-removed signal */
+struct adxl_vib_features {
+    int64_t timestamp; /* Of the first sample in the window */
+    uint32_t seq;      /* Of the first sample in the window */
+    float rms[3];      /* g */
+    float peak[3];     /* g, largest deviation from the mean */
+    float crest[3];    /* peak / rms */
+    float dominant_hz[3];                  /* Strongest bin, DC excluded */
+    float band_power[3][ADXL_VIB_MAX_BANDS]; /* g^2, Hann corrected, one sided */
+};
+
+struct adxl_vib;
+
+typedef void (*adxl_vib_fn)(const struct adxl_vib_features *features, void *arg);
+
+/* Returns NULL with errno set to EINVAL for a bad configuration, or ENOMEM */
+struct adxl_vib *adxl_vib_create(const struct adxl_vib_config *config);
+void adxl_vib_destroy(struct adxl_vib *vib);
+/* Drop buffered samples, e.g. after a sequence gap */
+void adxl_vib_reset(struct adxl_vib *vib);
+/* Buffer samples, calling fn for every window completed; returns the number of windows */
+int adxl_vib_push(struct adxl_vib *vib, const struct adxl_sample *samples, size_t count,
+                  adxl_vib_fn fn, void *arg);
@@ -8,6 +8,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "libadxl.h"
 #include "uadxl.h"
 
 #define DEVICE_PATH      "/dev/adxl0"
@@ -53,8 +54,15 @@
     } while (0)
 
 // Test configuration
-#define NUM_SAMPLES     5
-#define SAMPLE_DELAY_MS 100
+#define ADXL_MAX_INDICES 32
+#define NUM_SAMPLES      5
+#define SAMPLE_DELAY_MS  100
+
+// Performance budgets, per call, on a BeagleBone Black at 1MHz SPI
+#define PERF_ITERATIONS    1000
+#define PERF_IOCTL_BUDGET  20  /* us, ioctl dispatch and a cached register read */
+#define PERF_READ_BUDGET   400 /* us, single-mode read: SPI burst and formatting */
+#define PERF_BATCH_BUDGET  200 /* us, binary read of an already drained batch */
 
 void print_test_header(const char *test_name)
 {
@@ -179,7 +187,8 @@ void test_acceleration_readings(int fd)
         char buf[64];
         int x, y, z;
 
-        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        /* Every read from offset 0 samples a new line, the next one hits EOF */
+        ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
         if (n > 0) {
             buf[n] = '\0';
             if (sscanf(buf, "%d,%d,%d", &x, &y, &z) == 3) {
@@ -206,6 +215,191 @@ void test_acceleration_readings(int fd)
     print_test_footer(overall_success);
 }
 
+static bool check_sequence(const struct adxl_sample *samples, ssize_t n, uint32_t *expected)
+{
+    for (ssize_t i = 0; i < n; i++) {
+        if (*expected != UINT32_MAX && samples[i].seq != *expected) return false;
+        *expected = samples[i].seq + 1;
+    }
+    return true;
+}
+
+void test_library()
+{
+    print_test_header("CLIENT LIBRARY TEST");
+    bool overall_success = true;
+    struct adxl_sample samples[64];
+    uint32_t expected = UINT32_MAX;
+    int indices[ADXL_MAX_INDICES];
+    struct adxl_dev *dev;
+    size_t total = 0;
+
+    int count = adxl_discover(indices, ADXL_MAX_INDICES);
+    if (count <= 0) {
+        LOG_FAILURE("No devices discovered");
+        print_test_footer(false);
+        return;
+    }
+    LOG_VALUE("Devices discovered", count);
+
+    if (!(dev = adxl_open(indices[0], 0))) {
+        LOG_FAILURE("Failed to open device through the library");
+        print_test_footer(false);
+        return;
+    }
+
+    if (adxl_set_rate(dev, ADXL_RATE_400HZ) == 0) {
+        LOG_SUCCESS("Rate set to 400Hz");
+    } else {
+        LOG_FAILURE("Failed to set rate");
+        overall_success = false;
+    }
+
+    // Blocking batched reads
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        ssize_t n = adxl_read_samples(dev, samples, 64);
+        if (n <= 0 || !check_sequence(samples, n, &expected)) {
+            LOG_FAILURE("Batched read failed or skipped samples");
+            overall_success = false;
+            break;
+        }
+        LOG_VALUE("Batch of samples read", (int)n);
+    }
+
+    // Zero-copy ring consumer
+    if (adxl_ring_map(dev) == 0) {
+        LOG_SUCCESS("Ring mapped");
+        expected = UINT32_MAX;
+        while (total < 400) {
+            if (adxl_wait(dev, 1000) <= 0) {
+                LOG_FAILURE("Timed out waiting on the ring");
+                overall_success = false;
+                break;
+            }
+            size_t n = adxl_ring_consume(dev, samples, 64);
+            if (!check_sequence(samples, n, &expected) && !dev->reader.lost) {
+                LOG_FAILURE("Ring sequence mismatch");
+                overall_success = false;
+                break;
+            }
+            total += n;
+        }
+        LOG_VALUE("Samples consumed from ring", (int)total);
+        LOG_VALUE("Samples lost to overruns", (int)dev->reader.lost);
+    } else {
+        LOG_FAILURE("Failed to map ring");
+        overall_success = false;
+    }
+
+    adxl_close(dev);
+    print_test_footer(overall_success);
+}
+
+static double elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static bool check_budget(const char *what, double us, double budget)
+{
+    printf("%s%-28s %8.2f us/call (budget %.0f)%s\n", us <= budget ? COLOR_CYAN : COLOR_RED, what,
+           us, budget, COLOR_RESET);
+    return us <= budget;
+}
+
+// Times the hot paths and checks buffering behaviour, fails when a budget is exceeded
+bool test_performance()
+{
+    print_test_header("PERFORMANCE AND BUFFERING TEST");
+    bool overall_success = true;
+    struct adxl_sample samples[64];
+    struct adxl_dev *a, *b;
+    struct timespec start;
+    uint32_t expected_a = UINT32_MAX, expected_b = UINT32_MAX;
+    char buf[64];
+    int value;
+
+    int fd = open(DEVICE_PATH, O_RDWR);
+    if (fd < 0) {
+        LOG_FAILURE("Failed to open device");
+        print_test_footer(false);
+        return false;
+    }
+
+    // Keep the sensor awake so runtime PM resumes do not skew the numbers
+    ioctl(fd, ADXL_IOCTL_ENABLE);
+    pread(fd, buf, sizeof(buf), 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < PERF_ITERATIONS; i++) ioctl(fd, ADXL_IOCTL_GET_MODE, &value);
+    overall_success &= check_budget("ioctl dispatch", elapsed_us(&start) / PERF_ITERATIONS,
+                                    PERF_IOCTL_BUDGET);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < PERF_ITERATIONS; i++) ioctl(fd, ADXL_IOCTL_GET_RATE, &value);
+    overall_success &= check_budget("ioctl register read", elapsed_us(&start) / PERF_ITERATIONS,
+                                    PERF_READ_BUDGET);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < PERF_ITERATIONS; i++) pread(fd, buf, sizeof(buf), 0);
+    overall_success &= check_budget("single read (update_axis)",
+                                    elapsed_us(&start) / PERF_ITERATIONS, PERF_READ_BUDGET);
+    close(fd);
+
+    // Concurrent readers each get the full, gapless stream
+    if (!(a = adxl_open(0, 0)) || !(b = adxl_open(0, 0))) {
+        LOG_FAILURE("Failed to open concurrent readers");
+        adxl_close(a);
+        print_test_footer(false);
+        return false;
+    }
+    adxl_set_rate(a, ADXL_RATE_400HZ);
+
+    for (int i = 0; i < NUM_SAMPLES * 4; i++) {
+        ssize_t na = adxl_read_samples(a, samples, 64);
+        bool ok = na > 0 && check_sequence(samples, na, &expected_a);
+        ssize_t nb = adxl_read_samples(b, samples, 64);
+        if (!ok || nb <= 0 || !check_sequence(samples, nb, &expected_b)) {
+            LOG_FAILURE("Concurrent readers saw gaps");
+            overall_success = false;
+            break;
+        }
+    }
+    if (overall_success) LOG_SUCCESS("Concurrent readers saw gapless streams");
+
+    // Draining a full driver ring in batches
+    adxl_set_rate(a, ADXL_RATE_3200HZ);
+    usleep(100 * 1000);
+    adxl_set_nonblock(a, true);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int batches = 0;
+    while (adxl_read_samples(a, samples, 64) > 0) batches++;
+    if (batches)
+        overall_success &= check_budget("binary batch read", elapsed_us(&start) / batches,
+                                        PERF_BATCH_BUDGET);
+
+    // A reader stalled for longer than the ring holds skips ahead
+    expected_b = UINT32_MAX;
+    adxl_read_samples(b, samples, 1);
+    check_sequence(samples, 1, &expected_b);
+    usleep(1000 * 1000);
+    ssize_t n = adxl_read_samples(b, samples, 64);
+    if (n > 0 && samples[0].seq != expected_b) {
+        LOG_VALUE("Overrun detected, samples skipped", (int)(samples[0].seq - expected_b));
+    } else {
+        LOG_FAILURE("Stalled reader did not observe the overrun");
+        overall_success = false;
+    }
+
+    adxl_close(a);
+    adxl_close(b);
+    print_test_footer(overall_success);
+    return overall_success;
+}
+
 void test_sysfs_interface()
 {
     print_test_header("SYSFS INTERFACE TEST");
@@ -320,7 +514,9 @@ void print_help()
     printf("It performs the following tests:\n");
     printf("  1. IOCTL interface testing (enable/disable, rate/range settings)\n");
     printf("  2. Acceleration data reading\n");
-    printf("  3. Sysfs attribute interface testing\n\n");
+    printf("  3. Sysfs attribute interface testing\n");
+    printf("  4. Client library batched and ring reads\n");
+    printf("  5. Hot path timing against budgets, concurrent readers and overruns\n\n");
 }
 
 int main()
@@ -351,6 +547,12 @@ int main()
     // Test sysfs interface
     test_sysfs_interface();
 
+    // Test the client library
+    test_library();
+
+    // Performance regressions fail the run
+    bool perf_ok = test_performance();
+
     LOG_INFO("All tests completed");
-    return EXIT_SUCCESS;
+    return perf_ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,526 @@
+/**
+ * @file libadxl.c
+ * @brief Userspace client library for the ADXL345 driver
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <linux/genetlink.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libadxl.h"
+
+static int compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int adxl_discover(int *indices, int max)
+{
+    DIR *dir = opendir(ADXL_CLASS_PATH);
+    struct dirent *entry;
+    int count = 0, index;
+
+    if (!dir) return -1;
+
+    while ((entry = readdir(dir)) && count < max) {
+        if (sscanf(entry->d_name, "adxl%d", &index) == 1) indices[count++] = index;
+    }
+    closedir(dir);
+
+    qsort(indices, count, sizeof(*indices), compare_int);
+    return count;
+}
+
+struct adxl_dev *adxl_open(int index, int flags)
+{
+    struct adxl_dev *dev;
+    char path[64];
+
+    if (!(dev = calloc(1, sizeof(*dev)))) return NULL;
+
+    snprintf(path, sizeof(path), ADXL_DEV_PATH, index);
+    dev->fd = open(path, O_RDWR | O_CLOEXEC | (flags & O_NONBLOCK));
+    if (dev->fd < 0 || ioctl(dev->fd, ADXL_IOCTL_GET_MODE, &dev->mode) < 0) {
+        int err = errno;
+        if (dev->fd >= 0) close(dev->fd);
+        free(dev);
+        errno = err;
+        return NULL;
+    }
+
+    dev->index = index;
+    return dev;
+}
+
+void adxl_close(struct adxl_dev *dev)
+{
+    if (!dev) return;
+    if (dev->map) munmap(dev->map, dev->map_len);
+    close(dev->fd);
+    free(dev);
+}
+
+int adxl_fd(const struct adxl_dev *dev)
+{
+    return dev->fd;
+}
+
+int adxl_set_nonblock(struct adxl_dev *dev, bool nonblock)
+{
+    int flags = fcntl(dev->fd, F_GETFL);
+
+    if (flags < 0) return -1;
+    flags = nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return fcntl(dev->fd, F_SETFL, flags);
+}
+
+int adxl_enable(struct adxl_dev *dev)
+{
+    return ioctl(dev->fd, ADXL_IOCTL_ENABLE);
+}
+
+int adxl_disable(struct adxl_dev *dev)
+{
+    return ioctl(dev->fd, ADXL_IOCTL_DISABLE);
+}
+
+int adxl_get_rate(struct adxl_dev *dev, enum adxl_rate *rate)
+{
+    int value;
+
+    if (ioctl(dev->fd, ADXL_IOCTL_GET_RATE, &value) < 0) return -1;
+    *rate = value;
+    return 0;
+}
+
+int adxl_set_rate(struct adxl_dev *dev, enum adxl_rate rate)
+{
+    int value = rate;
+
+    if (rate < ADXL_RATE_0_10HZ || rate > ADXL_RATE_3200HZ) return errno = EINVAL, -1;
+    return ioctl(dev->fd, ADXL_IOCTL_SET_RATE, &value);
+}
+
+int adxl_get_range(struct adxl_dev *dev, enum adxl_range *range)
+{
+    int value;
+
+    if (ioctl(dev->fd, ADXL_IOCTL_GET_RANGE, &value) < 0) return -1;
+    *range = value;
+    return 0;
+}
+
+int adxl_set_range(struct adxl_dev *dev, enum adxl_range range)
+{
+    int value = range;
+
+    if (range < ADXL_RANGE_2G || range > ADXL_RANGE_16G) return errno = EINVAL, -1;
+    return ioctl(dev->fd, ADXL_IOCTL_SET_RANGE, &value);
+}
+
+int adxl_set_mode(struct adxl_dev *dev, int mode)
+{
+    if (mode == dev->mode) return 0;
+    if (ioctl(dev->fd, ADXL_IOCTL_SET_MODE, &mode) < 0) return -1;
+    dev->mode = mode;
+    return 0;
+}
+
+int adxl_get_stats(struct adxl_dev *dev, struct adxl_stats *stats)
+{
+    return ioctl(dev->fd, ADXL_IOCTL_GET_STATS, stats) < 0 ? -1 : 0;
+}
+
+double adxl_rate_hz(enum adxl_rate rate)
+{
+    return 3200.0 / (1 << (ADXL_RATE_3200HZ - rate));
+}
+
+static int sysfs_path(char *path, size_t len, int index, const char *attr)
+{
+    return snprintf(path, len, ADXL_CLASS_PATH "/adxl%d/%s", index, attr);
+}
+
+int adxl_sysfs_read(int index, const char *attr, int *val)
+{
+    char path[128];
+    FILE *file;
+    int ret;
+
+    sysfs_path(path, sizeof(path), index, attr);
+    if (!(file = fopen(path, "re"))) return -1;
+    ret = fscanf(file, "%d", val) == 1 ? 0 : (errno = EIO, -1);
+    fclose(file);
+    return ret;
+}
+
+int adxl_sysfs_write(int index, const char *attr, int val)
+{
+    char path[128], buf[16];
+    int fd, len, ret;
+
+    sysfs_path(path, sizeof(path), index, attr);
+    if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) return -1;
+    len = snprintf(buf, sizeof(buf), "%d", val);
+    ret = write(fd, buf, len) == len ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+ssize_t adxl_read_samples(struct adxl_dev *dev, struct adxl_sample *buf, size_t count)
+{
+    ssize_t n;
+
+    if (adxl_set_mode(dev, ADXL_MODE_BINARY) < 0) return -1;
+
+    n = read(dev->fd, buf, count * sizeof(*buf));
+    return n < 0 ? -1 : n / (ssize_t)sizeof(*buf);
+}
+
+ssize_t adxl_read_raw(struct adxl_dev *dev, void *buf, size_t len)
+{
+    if (adxl_set_mode(dev, ADXL_MODE_RAW) < 0) return -1;
+    return read(dev->fd, buf, len);
+}
+
+ssize_t adxl_write_samples(struct adxl_dev *dev, const struct adxl_sample *buf, size_t count)
+{
+    ssize_t n = write(dev->fd, buf, count * sizeof(*buf));
+    return n < 0 ? -1 : n / (ssize_t)sizeof(*buf);
+}
+
+int adxl_wait(struct adxl_dev *dev, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+
+    if (dev->map) {
+        if (!adxl_ring_empty(&dev->reader)) return 1;
+        /* Let the driver's poll() measure against what we consumed */
+        if (ioctl(dev->fd, ADXL_IOCTL_SET_TAIL, &dev->reader.tail) < 0) return -1;
+    } else if (dev->mode != ADXL_MODE_RAW && adxl_set_mode(dev, ADXL_MODE_BINARY) < 0) {
+        return -1;
+    }
+
+    return poll(&pfd, 1, timeout_ms);
+}
+
+int adxl_ring_map(struct adxl_dev *dev)
+{
+    struct adxl_ring ring;
+    void *map;
+
+    if (dev->map) return 0;
+
+    /* Keep the FIFO draining for as long as the ring is mapped */
+    if (adxl_set_mode(dev, ADXL_MODE_BINARY) < 0) return -1;
+
+    /* Peek at the header for the full size first */
+    map = mmap(NULL, sizeof(ring), PROT_READ, MAP_SHARED, dev->fd, 0);
+    if (map == MAP_FAILED) return -1;
+    memcpy(&ring, map, sizeof(ring));
+    munmap(map, sizeof(ring));
+
+    if (ring.magic != ADXL_RING_MAGIC) return errno = EPROTO, -1;
+
+    dev->map_len = ring.data_offset + (size_t)ring.size * ring.sample_size;
+    map = mmap(NULL, dev->map_len, PROT_READ, MAP_SHARED, dev->fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    dev->map = map;
+    return adxl_ring_attach(&dev->reader, map);
+}
+
+size_t adxl_ring_consume(struct adxl_dev *dev, struct adxl_sample *buf, size_t count)
+{
+    return dev->map ? adxl_ring_read(&dev->reader, buf, count) : 0;
+}
+
+int adxl_ring_attach(struct adxl_ring_reader *reader, const void *mem)
+{
+    const struct adxl_ring *ring = mem;
+
+    if (ring->magic != ADXL_RING_MAGIC || ring->sample_size != sizeof(struct adxl_sample) ||
+        !ring->size || (ring->size & (ring->size - 1)))
+        return errno = EPROTO, -1;
+
+    reader->ring = ring;
+    reader->slots = (const struct adxl_sample *)((const char *)mem + ring->data_offset);
+    reader->tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    reader->lost = 0;
+    return 0;
+}
+
+bool adxl_ring_empty(const struct adxl_ring_reader *reader)
+{
+    return __atomic_load_n(&reader->ring->head, __ATOMIC_ACQUIRE) == reader->tail;
+}
+
+size_t adxl_ring_read(struct adxl_ring_reader *reader, struct adxl_sample *buf, size_t count)
+{
+    uint32_t size = reader->ring->size, mask = size - 1;
+    uint32_t head, reserve, n, i, torn = 0;
+
+    head = __atomic_load_n(&reader->ring->head, __ATOMIC_ACQUIRE);
+
+    /* Overrun, the oldest samples we had not consumed are gone */
+    if (head - reader->tail > size) {
+        reader->lost += head - reader->tail - size;
+        reader->tail = head - size;
+    }
+
+    n = head - reader->tail;
+    if (n > count) n = count;
+
+    for (i = 0; i < n; i++) buf[i] = reader->slots[(reader->tail + i) & mask];
+
+    /* Drop copies of slots the producer started rewriting meanwhile */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    reserve = __atomic_load_n(&reader->ring->reserve, __ATOMIC_RELAXED);
+    if (reserve - reader->tail > size) {
+        torn = reserve - size - reader->tail;
+        if (torn > n) torn = n;
+        memmove(buf, buf + torn, (n - torn) * sizeof(*buf));
+        reader->lost += torn;
+    }
+
+    reader->tail += n;
+    return n - torn;
+}
+
+static long futex(const uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+int adxl_ring_wait(struct adxl_ring_reader *reader, int timeout_ms)
+{
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    uint32_t head = __atomic_load_n(&reader->ring->head, __ATOMIC_ACQUIRE);
+
+    if (head != reader->tail) return 1;
+
+    /* Shared, not private, futex: the publisher is another process */
+    if (futex(&reader->ring->head, FUTEX_WAIT, head, timeout_ms < 0 ? NULL : &ts) < 0 &&
+        errno != EAGAIN) {
+        return errno == ETIMEDOUT ? 0 : -1;
+    }
+
+    return !adxl_ring_empty(reader);
+}
+
+size_t adxl_ring_bytes(uint32_t size)
+{
+    return sizeof(struct adxl_ring) + (size_t)size * sizeof(struct adxl_sample);
+}
+
+void adxl_ring_init(void *mem, uint32_t size)
+{
+    struct adxl_ring *ring = mem;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->size = size;
+    ring->data_offset = sizeof(*ring);
+    ring->sample_size = sizeof(struct adxl_sample);
+    __atomic_store_n(&ring->magic, ADXL_RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+void adxl_ring_publish(struct adxl_ring *ring, const struct adxl_sample *samples, size_t count)
+{
+    struct adxl_sample *slots = (struct adxl_sample *)((char *)ring + ring->data_offset);
+    uint32_t head = ring->head, mask = ring->size - 1;
+
+    if (!count) return;
+
+    /* Same protocol as the driver: reserve, fill, then publish */
+    __atomic_store_n(&ring->reserve, head + count, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (size_t i = 0; i < count; i++) slots[(head + i) & mask] = samples[i];
+
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+    futex(&ring->head, FUTEX_WAKE, INT32_MAX, NULL);
+}
+
+int adxl_shm_attach(int index, struct adxl_ring_reader *reader)
+{
+    char name[32];
+    struct stat st;
+    void *map;
+    int fd;
+
+    snprintf(name, sizeof(name), ADXL_SHM_NAME, index);
+    if ((fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0)) < 0) return -1;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct adxl_ring)) {
+        close(fd);
+        return errno = EPROTO, -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    if (adxl_ring_attach(reader, map) < 0 || adxl_ring_bytes(reader->ring->size) > (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return errno = EPROTO, -1;
+    }
+
+    return 0;
+}
+
+void adxl_shm_detach(struct adxl_ring_reader *reader)
+{
+    if (reader->ring) munmap((void *)reader->ring, adxl_ring_bytes(reader->ring->size));
+    reader->ring = NULL;
+}
+
+/* ------------------------------------------------------------ Netlink feed */
+
+#define NL_BUF_SIZE 4096
+
+#define NLA_NEXT(nla) ((struct nlattr *)((char *)(nla) + NLA_ALIGN((nla)->nla_len)))
+#define NLA_DATA(nla) ((void *)((char *)(nla) + NLA_HDRLEN))
+#define NLA_OK(nla, end) \
+    ((char *)(nla) + NLA_HDRLEN <= (end) && (nla)->nla_len >= NLA_HDRLEN && \
+     (char *)(nla) + (nla)->nla_len <= (end))
+
+/* Join the multicast group called name out of a CTRL_ATTR_MCAST_GROUPS nest */
+static int nl_join_group(int fd, struct nlattr *groups, const char *name)
+{
+    char *end = (char *)groups + groups->nla_len;
+
+    for (struct nlattr *grp = NLA_DATA(groups); NLA_OK(grp, end); grp = NLA_NEXT(grp)) {
+        char *grp_end = (char *)grp + grp->nla_len;
+        const char *grp_name = NULL;
+        uint32_t id = 0;
+
+        for (struct nlattr *a = NLA_DATA(grp); NLA_OK(a, grp_end); a = NLA_NEXT(a)) {
+            if (a->nla_type == CTRL_ATTR_MCAST_GRP_NAME) grp_name = NLA_DATA(a);
+            if (a->nla_type == CTRL_ATTR_MCAST_GRP_ID) id = *(uint32_t *)NLA_DATA(a);
+        }
+
+        if (grp_name && !strcmp(grp_name, name))
+            return setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &id, sizeof(id));
+    }
+
+    return errno = ENOENT, -1;
+}
+
+int adxl_nl_open(bool events, bool summaries)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct genlmsghdr genl;
+        char attrs[NLA_HDRLEN + NLA_ALIGN(sizeof(ADXL_GENL_NAME))];
+    } req = {
+        .nlh = {
+            .nlmsg_len = sizeof(req),
+            .nlmsg_type = GENL_ID_CTRL,
+            .nlmsg_flags = NLM_F_REQUEST,
+        },
+        .genl = { .cmd = CTRL_CMD_GETFAMILY, .version = 1 },
+    };
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+    struct nlattr *nla = (struct nlattr *)req.attrs, *groups = NULL;
+    char buf[NL_BUF_SIZE], *end;
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    ssize_t len;
+    int fd;
+
+    nla->nla_type = CTRL_ATTR_FAMILY_NAME;
+    nla->nla_len = NLA_HDRLEN + sizeof(ADXL_GENL_NAME);
+    memcpy(NLA_DATA(nla), ADXL_GENL_NAME, sizeof(ADXL_GENL_NAME));
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC)) < 0) return -1;
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        send(fd, &req, sizeof(req), 0) < 0 || (len = recv(fd, buf, sizeof(buf), 0)) < 0)
+        goto fail;
+
+    /* An NLMSG_ERROR reply means the driver is not loaded */
+    if (!NLMSG_OK(nlh, len) || nlh->nlmsg_type != GENL_ID_CTRL) {
+        errno = ENOENT;
+        goto fail;
+    }
+
+    end = (char *)nlh + nlh->nlmsg_len;
+    for (nla = (struct nlattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN); NLA_OK(nla, end);
+         nla = NLA_NEXT(nla))
+        if (nla->nla_type == CTRL_ATTR_MCAST_GROUPS) groups = nla;
+
+    if (!groups) {
+        errno = ENOENT;
+        goto fail;
+    }
+
+    if ((events && nl_join_group(fd, groups, ADXL_GENL_MCGRP_EVENTS) < 0) ||
+        (summaries && nl_join_group(fd, groups, ADXL_GENL_MCGRP_SUMMARIES) < 0))
+        goto fail;
+
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+int adxl_nl_recv(int fd, struct adxl_nl_msg *msg)
+{
+    char buf[NL_BUF_SIZE], *end;
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    struct genlmsghdr *genl;
+    ssize_t len;
+
+    if ((len = recv(fd, buf, sizeof(buf), 0)) < 0) return -1;
+    if (!NLMSG_OK(nlh, len) || nlh->nlmsg_type < NLMSG_MIN_TYPE) return 0;
+
+    genl = NLMSG_DATA(nlh);
+    if (genl->cmd != ADXL_CMD_EVENT && genl->cmd != ADXL_CMD_SUMMARY) return 0;
+
+    memset(msg, 0, sizeof(*msg));
+    msg->cmd = genl->cmd;
+
+    end = (char *)nlh + nlh->nlmsg_len;
+    for (struct nlattr *nla = (struct nlattr *)((char *)genl + GENL_HDRLEN); NLA_OK(nla, end);
+         nla = NLA_NEXT(nla)) {
+        void *data = NLA_DATA(nla);
+
+        switch (nla->nla_type) {
+        case ADXL_ATTR_DEVICE:
+            memcpy(&msg->device, data, sizeof(msg->device));
+            break;
+        case ADXL_ATTR_TIMESTAMP:
+            memcpy(&msg->timestamp, data, sizeof(msg->timestamp));
+            break;
+        case ADXL_ATTR_SEQ:
+            memcpy(&msg->seq, data, sizeof(msg->seq));
+            break;
+        case ADXL_ATTR_EVENTS:
+            memcpy(&msg->events, data, sizeof(msg->events));
+            break;
+        case ADXL_ATTR_STATS:
+            if (nla->nla_len >= NLA_HDRLEN + sizeof(msg->stats))
+                memcpy(&msg->stats, data, sizeof(msg->stats));
+            break;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file libadxl.h
+ * @brief Userspace client library for the ADXL345 driver
+ *
+ * Functions returning int or ssize_t fail with -1 and errno set.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "uadxl.h"
+
+#define ADXL_DEV_PATH   "/dev/adxl%d"
+#define ADXL_CLASS_PATH "/sys/class/adxl_class"
+#define ADXL_SHM_NAME   "/adxl%d" /* Rings published by adxld */
+
+/* BW_RATE codes, see adxl_rate_hz() */
+enum adxl_rate {
+    ADXL_RATE_0_10HZ,
+    ADXL_RATE_0_20HZ,
+    ADXL_RATE_0_39HZ,
+    ADXL_RATE_0_78HZ,
+    ADXL_RATE_1_56HZ,
+    ADXL_RATE_3_13HZ,
+    ADXL_RATE_6_25HZ,
+    ADXL_RATE_12_5HZ,
+    ADXL_RATE_25HZ,
+    ADXL_RATE_50HZ,
+    ADXL_RATE_100HZ,
+    ADXL_RATE_200HZ,
+    ADXL_RATE_400HZ,
+    ADXL_RATE_800HZ,
+    ADXL_RATE_1600HZ,
+    ADXL_RATE_3200HZ,
+};
+
+enum adxl_range {
+    ADXL_RANGE_2G,
+    ADXL_RANGE_4G,
+    ADXL_RANGE_8G,
+    ADXL_RANGE_16G,
+};
+
+/* One message of the ADXL_GENL_NAME generic netlink feed */
+struct adxl_nl_msg {
+    int cmd;                 /* ADXL_CMD_EVENT or ADXL_CMD_SUMMARY */
+    uint32_t device;         /* N of /dev/adxlN */
+    int64_t timestamp;       /* Events only */
+    uint32_t seq;            /* Events only */
+    uint32_t events;         /* ADXL_EVENT_*, events only */
+    struct adxl_stats stats; /* Summaries only */
+};
+
+/* Lock-free consumer of a struct adxl_ring, driver mmap or shared memory */
+struct adxl_ring_reader {
+    const struct adxl_ring *ring;
+    const struct adxl_sample *slots;
+    uint32_t tail;  /* Sequence of the next sample to consume */
+    uint64_t lost;  /* Samples overwritten before they were consumed */
+};
+
+struct adxl_dev {
+    int index;
+    int fd;
+    int mode;
+    void *map;
+    size_t map_len;
+    struct adxl_ring_reader reader;
+};
+
+/* Fill indices with the probed /dev/adxlN numbers, ascending; returns count */
+int adxl_discover(int *indices, int max);
+
+/* flags may hold O_NONBLOCK, which makes reads fail with EAGAIN when empty */
+struct adxl_dev *adxl_open(int index, int flags);
+void adxl_close(struct adxl_dev *dev);
+int adxl_fd(const struct adxl_dev *dev);
+int adxl_set_nonblock(struct adxl_dev *dev, bool nonblock);
+
+int adxl_enable(struct adxl_dev *dev);
+int adxl_disable(struct adxl_dev *dev);
+int adxl_get_rate(struct adxl_dev *dev, enum adxl_rate *rate);
+int adxl_set_rate(struct adxl_dev *dev, enum adxl_rate rate);
+int adxl_get_range(struct adxl_dev *dev, enum adxl_range *range);
+int adxl_set_range(struct adxl_dev *dev, enum adxl_range range);
+int adxl_set_mode(struct adxl_dev *dev, int mode);
+double adxl_rate_hz(enum adxl_rate rate);
+/* Statistics run while stats_window_ms is nonzero; returns the last completed window */
+int adxl_get_stats(struct adxl_dev *dev, struct adxl_stats *stats);
+
+/* Integer sysfs attributes of /sys/class/adxl_class/adxlN */
+int adxl_sysfs_read(int index, const char *attr, int *val);
+int adxl_sysfs_write(int index, const char *attr, int val);
+
+/* Batched read of up to count samples, returns the number read */
+ssize_t adxl_read_samples(struct adxl_dev *dev, struct adxl_sample *buf, size_t count);
+
+/* ADXL_MODE_RAW read of whole FIFO drains, len >= ADXL_RAW_BURST_MAX; see adxlraw.h */
+ssize_t adxl_read_raw(struct adxl_dev *dev, void *buf, size_t len);
+
+/* Queue samples on a replay device (replay_devices=N), returns the number accepted */
+ssize_t adxl_write_samples(struct adxl_dev *dev, const struct adxl_sample *buf, size_t count);
+
+/* Wait until samples are available, timeout_ms < 0 waits forever; returns 0 on timeout */
+int adxl_wait(struct adxl_dev *dev, int timeout_ms);
+
+/* Map the driver ring and start consuming from the newest sample */
+int adxl_ring_map(struct adxl_dev *dev);
+size_t adxl_ring_consume(struct adxl_dev *dev, struct adxl_sample *buf, size_t count);
+
+int adxl_ring_attach(struct adxl_ring_reader *reader, const void *mem);
+size_t adxl_ring_read(struct adxl_ring_reader *reader, struct adxl_sample *buf, size_t count);
+bool adxl_ring_empty(const struct adxl_ring_reader *reader);
+
+/* Futex wait for a publisher to move head, timeout_ms < 0 waits forever; returns 0 on timeout */
+int adxl_ring_wait(struct adxl_ring_reader *reader, int timeout_ms);
+
+/* Producer side of a ring in memory we own, e.g. POSIX shared memory */
+size_t adxl_ring_bytes(uint32_t size);
+void adxl_ring_init(void *mem, uint32_t size);
+void adxl_ring_publish(struct adxl_ring *ring, const struct adxl_sample *samples, size_t count);
+
+/* Map the ring adxld publishes for /dev/adxlN read-only and attach reader to it */
+int adxl_shm_attach(int index, struct adxl_ring_reader *reader);
+void adxl_shm_detach(struct adxl_ring_reader *reader);
+
+/* Subscribe to the events and/or summaries of every sensor; returns a socket to poll(2) */
+int adxl_nl_open(bool events, bool summaries);
+/* Receive one message, 0 for a message of no interest; blocks unless the socket does not */
+int adxl_nl_recv(int fd, struct adxl_nl_msg *msg);
@@ -7,9 +7,10 @@
 #pragma once
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define ADXL_MAGIC 0x4c
-#define ADXL_MAXNR 6
+#define ADXL_MAXNR 10
 
 #define ADXL_IOCTL_ENABLE _IO(ADXL_MAGIC, 0)
 #define ADXL_IOCTL_DISABLE _IO(ADXL_MAGIC, 1)
@@ -18,3 +19,168 @@
 #define ADXL_IOCTL_GET_RANGE _IOR(ADXL_MAGIC, 4, int)
 #define ADXL_IOCTL_SET_RANGE _IOW(ADXL_MAGIC, 5, int)
 #define ADXL_IOCTL_CALIBRATE _IO(ADXL_MAGIC, 6)
+#define ADXL_IOCTL_GET_MODE _IOR(ADXL_MAGIC, 7, int)
+#define ADXL_IOCTL_SET_MODE _IOW(ADXL_MAGIC, 8, int)
+#define ADXL_IOCTL_SET_TAIL _IOW(ADXL_MAGIC, 9, __u32)
+#define ADXL_IOCTL_GET_STATS _IOR(ADXL_MAGIC, 10, struct adxl_stats)
+
+/*
+ * Attributes of /sys/class/adxl_class/adxlN besides rate, range, offset
+ * and x, y, z:
+ *
+ *   mode                Read mode new fds start in, ADXL_MODE_*
+ *   stats_window_ms     Statistics window, 0 stops it, see adxl_stats
+ *   stats               Last window as text, supports poll(2)
+ *   odr_mhz, odr_ppm    Measured output data rate and its deviation from
+ *                       nominal, as the sensor clock drifts a few percent
+ *   resume_latency_us   Last runtime resume to its first valid sample
+ *   probe_time_us       How long the asynchronous probe took
+ *   worker_cpu          CPU the acquisition thread adxl/<dev> runs on, -1
+ *                       for any
+ *   worker_priority     Its nice value (default -20), fifo or fifo_low
+ *   worker_utilization  Its busy permille over the last completed second
+ *   worker_busy_us      Its total time spent draining
+ *   events, tap, ...    Event functions, see ADXL_EVENT_OVERRUN
+ *   replay_speed        Replay devices only, multiple of real time the
+ *                       queued capture plays at, 0 as fast as drained
+ *
+ * The sensor drops to standby 2 s after the last read or stream, tunable
+ * in the parent device's power/autosuspend_delay_ms.
+ */
+
+/*
+ * Read modes of an open fd. Blocking modes honour O_NONBLOCK and
+ * IOCB_NOWAIT, so one io_uring instance can service many devices.
+ */
+#define ADXL_MODE_SINGLE 0 /* One "x,y,z" line, then EOF */
+#define ADXL_MODE_STREAM 1 /* Blocking "timestamp,seq,x,y,z" lines */
+#define ADXL_MODE_BINARY 2 /* Blocking arrays of struct adxl_sample */
+#define ADXL_MODE_RAW 3 /* Blocking FIFO bursts, see struct adxl_raw_burst */
+
+struct adxl_sample {
+	__s64 timestamp; /* CLOCK_MONOTONIC, ns */
+	__u32 seq; /* Samples drained before this one, shared with raw bursts */
+	__s16 x, y, z;
+	__u16 reserved;
+};
+
+/*
+ * ADXL_MODE_RAW reads return whole drains of the sensor FIFO as drained:
+ * this header followed by count undecoded 6-byte DATAX0..DATAZ1 bursts,
+ * then the next header. Buffers must hold at least ADXL_RAW_BURST_MAX.
+ * Sample i was taken at timestamp + i * 10^12 / odr_mhz ns.
+ */
+#define ADXL_RAW_SAMPLE_SIZE 6
+#define ADXL_RAW_MAX_COUNT 32 /* Entries of the sensor FIFO */
+#define ADXL_RAW_BURST_MAX                 \
+	(sizeof(struct adxl_raw_burst) + \
+	 ADXL_RAW_MAX_COUNT * ADXL_RAW_SAMPLE_SIZE)
+#define ADXL_RAW_LOST 0x01 /* The reader fell behind, bursts were dropped */
+
+struct adxl_raw_burst {
+	__s64 timestamp; /* First sample, CLOCK_MONOTONIC ns */
+	__u32 odr_mhz; /* Measured output data rate */
+	__u32 seq; /* Samples drained before this burst */
+	__u16 count; /* 6-byte bursts that follow */
+	__u8 data_format; /* DATA_FORMAT: range, JUSTIFY and FULL_RES */
+	__u8 flags; /* ADXL_RAW_* */
+	__u32 reserved;
+};
+
+/*
+ * Summary of one statistics window, see the stats_window_ms attribute.
+ * Values are raw LSB; rms is sqrt(sumsq[i] / count).
+ */
+struct adxl_stats {
+	__s64 start; /* Timestamp of the first sample */
+	__s64 end; /* Timestamp of the last sample */
+	__u32 seq; /* Window number, increments per published window */
+	__u32 count; /* Samples in the window */
+	__s16 min[3], max[3];
+	__s32 mean[3]; /* Q24.8 fixed point */
+	__s64 sum[3];
+	__u64 sumsq[3];
+};
+
+/*
+ * Generic netlink family multicasting for every probed device. The events
+ * group gets an ADXL_CMD_EVENT per FIFO drain that latched any of the
+ * ADXL_EVENT_* interrupt sources, the summaries group an ADXL_CMD_SUMMARY
+ * per statistics window (see stats_window_ms). Subscribers tell devices
+ * apart by ADXL_ATTR_DEVICE, the N of /dev/adxlN.
+ */
+#define ADXL_GENL_NAME "adxl"
+#define ADXL_GENL_VERSION 1
+#define ADXL_GENL_MCGRP_EVENTS "events"
+#define ADXL_GENL_MCGRP_SUMMARIES "summaries"
+
+enum adxl_genl_cmd {
+	ADXL_CMD_UNSPEC,
+	ADXL_CMD_EVENT,
+	ADXL_CMD_SUMMARY,
+	__ADXL_CMD_MAX,
+};
+
+enum adxl_genl_attr {
+	ADXL_ATTR_UNSPEC,
+	ADXL_ATTR_DEVICE, /* u32 */
+	ADXL_ATTR_TIMESTAMP, /* s64, CLOCK_MONOTONIC ns of the drain */
+	ADXL_ATTR_EVENTS, /* u32, ADXL_EVENT_* */
+	ADXL_ATTR_SEQ, /* u32, samples drained before the event */
+	ADXL_ATTR_STATS, /* struct adxl_stats */
+	ADXL_ATTR_PAD,
+	__ADXL_ATTR_MAX,
+};
+#define ADXL_ATTR_MAX (__ADXL_ATTR_MAX - 1)
+
+/*
+ * INT_SOURCE bits reported as events. Only FIFO drains read INT_SOURCE, and
+ * only overruns are reported out of the box: the other events need their
+ * bits written to the events attribute of /sys/class/adxl_class/adxlN,
+ * which keeps the sensor streaming while any is enabled, as a nonzero
+ * stats_window_ms does. Their settings are raw register codes:
+ *
+ *   tap         "THRESH_TAP DUR LATENT WINDOW", 62.5 mg, 625 us, 1.25 ms
+ *               and 1.25 ms per LSB, default 3 g, 10 ms, 100 ms, 250 ms
+ *   activity    "THRESH_ACT", 62.5 mg per LSB relative to when activity
+ *               detection started, default 0.5 g
+ *   inactivity  "THRESH_INACT TIME_INACT", 62.5 mg and 1 s per LSB,
+ *               default 0.25 g for 5 s
+ *   free_fall   "THRESH_FF TIME_FF", 62.5 mg and 5 ms per LSB on all
+ *               axes, default 0.44 g for 150 ms
+ *
+ * Events latch on the sensor and are reported by the next drain, within
+ * a FIFO watermark of samples.
+ */
+#define ADXL_EVENT_OVERRUN 0x01 /* The sensor FIFO dropped samples */
+#define ADXL_EVENT_FREE_FALL 0x04
+#define ADXL_EVENT_INACTIVITY 0x08
+#define ADXL_EVENT_ACTIVITY 0x10
+#define ADXL_EVENT_DOUBLE_TAP 0x20
+#define ADXL_EVENT_SINGLE_TAP 0x40
+#define ADXL_EVENT_ALL 0x7D
+
+/*
+ * Read-only shared ring, mmap(2) of /dev/adxlN from offset 0.
+ *
+ * The driver fills slot (head & (size - 1)) for each sample while any fd
+ * of the device is streaming in a mode other than ADXL_MODE_RAW. It bumps
+ * 'reserve' before overwriting slots and publishes 'head' after filling
+ * them, so a consumer that copied slots from tail up to head and then sees
+ * reserve - tail > size knows the oldest were torn. head counts published
+ * samples only; adxl_sample.seq also counts those drained while only raw
+ * streams were open, which shows up as a gap.
+ * ADXL_IOCTL_SET_TAIL tells poll(2) how far the consumer got.
+ */
+#define ADXL_RING_MAGIC 0x4c584441 /* "ADXL" */
+
+struct adxl_ring {
+	__u32 magic;
+	__u32 size; /* Number of slots, power of 2 */
+	__u32 data_offset; /* First slot, from the start of the mapping */
+	__u32 sample_size;
+	__u32 head; /* Sequence of the next sample to be published */
+	__u32 reserve; /* Slots before this sequence may be rewritten */
+	__u32 odr_mhz; /* Measured output data rate, 0 before the first drain */
+	__u32 reserved[9];
+};